@@ -0,0 +1,196 @@
+/*
+ * Crypto constant scanner used by loopdetect to rank loop candidates
+ *
+ * 1. Build a dictionary of well known crypto constants, optionally from a file
+ * 2. Find the constants in the immediate values and memory addresses of instructions
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+#include "core.h"
+#include "constscan.h"
+
+vector<CryptoConst> constdict;  // all dictionary entries
+vector<uint32_t> constval;      // values of single constants, searched with SIMD
+vector<int> constid;            // constval index -> dictionary id
+vector<int> tableid;            // dictionary ids of table ranges
+map<unsigned int, vector<int> > immhits; // static instruction -> constants in its immediates
+
+void addConst(string name, uint32_t v)
+{
+     if (findConst(v) >= 0) return;
+
+     CryptoConst c = {name, v, v};
+     constid.push_back(constdict.size());
+     constval.push_back(v);
+     constdict.push_back(c);
+}
+
+void addTable(string name, uint32_t start, uint32_t end)
+{
+     CryptoConst c = {name, start, end};
+     tableid.push_back(constdict.size());
+     constdict.push_back(c);
+}
+
+// built-in dictionary, round constants are computed from their definitions
+void initConstDict()
+{
+     addConst("tea_delta", 0x9e3779b9);
+     addConst("tea_delta_neg", 0x61c88647);
+     addConst("rc5_p32", 0xb7e15163);
+
+     addConst("md5_init", 0x67452301);
+     addConst("md5_init", 0xefcdab89);
+     addConst("md5_init", 0x98badcfe);
+     addConst("md5_init", 0x10325476);
+     addConst("sha1_init", 0xc3d2e1f0);
+
+     // MD5 T[i] = floor(abs(sin(i)) * 2^32)
+     for (int i = 1; i <= 64; ++i) {
+          addConst("md5_t", (uint32_t)(fabsl(sinl(i)) * 4294967296.0L));
+     }
+
+     addConst("sha1_k", 0x5a827999);
+     addConst("sha1_k", 0x6ed9eba1);
+     addConst("sha1_k", 0x8f1bbcdc);
+     addConst("sha1_k", 0xca62c1d6);
+
+     // SHA-256 K: fractional parts of the cube roots of the first 64 primes,
+     // initial values: fractional parts of the square roots of the first 8 primes
+     int n = 0;
+     for (int p = 2; n < 64; ++p) {
+          int d;
+          for (d = 2; d * d <= p && p % d != 0; ++d) ;
+          if (d * d <= p) continue;
+
+          long double r = cbrtl(p);
+          addConst("sha256_k", (uint32_t)((r - floorl(r)) * 4294967296.0L));
+          if (n < 8) {
+               r = sqrtl(p);
+               addConst("sha256_init", (uint32_t)((r - floorl(r)) * 4294967296.0L));
+          }
+          ++n;
+     }
+}
+
+// Load dictionary entries from a file, one entry per line:
+//   <value> <name>          a constant
+//   <start>-<end> <name>    a table address range
+int loadConstDict(const char *filename)
+{
+     ifstream infile(filename);
+     if (!infile.is_open()) return 1;
+
+     string line, range, name;
+     while (getline(infile, line)) {
+          if (line.empty() || line[0] == '#') continue;
+
+          istringstream strbuf(line);
+          strbuf >> range >> name;
+          size_t dash = range.find('-');
+          if (dash == string::npos)
+               addConst(name, stoul(range, 0, 16));
+          else
+               addTable(name, stoul(range.substr(0, dash), 0, 16), stoul(range.substr(dash + 1), 0, 16));
+     }
+
+     return 0;
+}
+
+#ifdef __SSE2__
+// The 8 lane search is compiled for AVX2 whatever the build flags are, and
+// findConst only calls it when the CPU has AVX2.
+static bool hasAVX2()
+{
+     __builtin_cpu_init();
+     return __builtin_cpu_supports("avx2");
+}
+
+static const bool cpuavx2 = hasAVX2();
+
+// search d[*i, n) 8 values at a time, the position of v or -1; *i is left
+// at the first value not searched
+__attribute__((target("avx2")))
+int findConst8(const uint32_t *d, int n, uint32_t v, int *i)
+{
+     __m256i key8 = _mm256_set1_epi32(v);
+     for (; *i + 8 <= n; *i += 8) {
+          __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(d + *i)), key8);
+          int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+          if (mask != 0) return *i + __builtin_ctz(mask);
+     }
+     return -1;
+}
+#endif
+
+// return the dictionary id of the constant v, or -1
+int findConst(uint32_t v)
+{
+     int i = 0, n = constval.size();
+     const uint32_t *d = constval.data();
+
+#ifdef __SSE2__
+     if (cpuavx2) {
+          int k = findConst8(d, n, v, &i);
+          if (k >= 0) return constid[k];
+     }
+
+     __m128i key4 = _mm_set1_epi32(v);
+     for (; i + 4 <= n; i += 4) {
+          __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(d + i)), key4);
+          int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+          if (mask != 0) return constid[i + __builtin_ctz(mask)];
+     }
+#endif
+     for (; i < n; ++i) {
+          if (d[i] == v) return constid[i];
+     }
+
+     return -1;
+}
+
+// collect the dictionary ids hit by the immediates and the memory address of ins
+void scanInst(Inst *ins, vector<int> *hits)
+{
+     map<unsigned int, vector<int> >::iterator it = immhits.find(ins->addrn);
+     if (it == immhits.end()) {
+          // scan the immediates once per static instruction
+          vector<int> h;
+          string &s = ins->assembly;
+          for (size_t pos = s.find("0x"); pos != string::npos; pos = s.find("0x", pos + 2)) {
+               if (!isxdigit(s[pos + 2])) continue;
+               int id = findConst(stoul(s.substr(pos), 0, 16));
+               if (id >= 0) h.push_back(id);
+          }
+          it = immhits.insert(make_pair(ins->addrn, h)).first;
+     }
+     hits->insert(hits->end(), it->second.begin(), it->second.end());
+
+     if (ins->memaddr == 0) return;
+     for (vector<int>::iterator ii = tableid.begin(); ii != tableid.end(); ++ii) {
+          if (ins->memaddr >= constdict[*ii].start && ins->memaddr < constdict[*ii].end)
+               hits->push_back(*ii);
+     }
+}
+
+string getConstName(int id)
+{
+     return constdict[id].name;
+}
@@ -0,0 +1,19 @@
+// Crypto constant scanner
+//
+// Magic numbers of cryptographic algorithms (round constants, initial hash
+// values, key schedule deltas) betray a loop as a crypto candidate. The
+// dictionary holds single constants, matched against the immediate values of
+// an instruction, and address ranges of lookup tables, matched against the
+// memory access address.
+
+struct CryptoConst {
+     string name;
+     uint32_t start;
+     uint32_t end;              // end > start for a table range [start, end)
+};
+
+void initConstDict();
+int loadConstDict(const char *filename);
+int findConst(uint32_t v);
+void scanInst(Inst *ins, vector<int> *hits);
+string getConstName(int id);
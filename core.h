@@ -1,13 +1,20 @@
+// Register ids. The first eight are the context registers of the trace in
+// the order of Inst::ctxreg, the 8- and 16-bit registers alias them.
+enum RegId {EAX, EBX, ECX, EDX, ESI, EDI, ESP, EBP,
+            CS, DS, ES, FS, GS, SS, ST0, ST1, ST2, ST3, ST4, ST5, NREG};
+
 struct Operand {
-     enum OprTy {ImmValue, Reg, Mem};
+     enum OprTy {ImmValue, Reg, Mem, Invalid};   // Invalid: not parsed
      OprTy ty;
      int tag;
      int bit;
      bool issegaddr;
      string segreg;             // for seg mem access like fs:[0x1]
      string field[5];
+     int regid[2];              // ids of the registers in field[0] and field[1], -1 if none
+     int regoff;                // bit offset of a sub-register, 8 for ah
 
-     Operand() : bit(0),issegaddr(false) {}
+     Operand() : ty(Invalid),tag(0),bit(0),issegaddr(false),regid{-1, -1},regoff(0) {}
 };
 
 struct Inst {
@@ -23,7 +30,7 @@ struct Inst {
      uint32_t ctxreg[8];
      uint32_t memaddr;
 
-     uint32_t getRegVal(string reg);
+     uint32_t getRegVal(Operand *op);
 };
 
 typedef pair< map<int,int>, map<int,int> > FullMap;
@@ -0,0 +1,101 @@
+/*
+ * Aggregated diagnostics shared by the symbolic execution engines
+ *
+ * 1. Every (instruction address, message) pair gets a counter, found once
+ *    per static instruction and bumped for every dynamic occurrence
+ * 2. The counters are printed sorted by count at the end of the run
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+
+#include "diag.h"
+
+struct DiagSite {
+     uint32_t addr;
+     string msg;
+     atomic<uint64_t> count;
+};
+
+map< pair<uint32_t, string>, DiagSite* > diagsites;
+mutex diagmutex;                // engines may run on several threads
+FILE *diaglog = NULL;           // verbose log of every occurrence
+
+DiagSite *getDiagSite(uint32_t addr, string msg)
+{
+     lock_guard<mutex> lock(diagmutex);
+     pair<uint32_t, string> key(addr, msg);
+     map< pair<uint32_t, string>, DiagSite* >::iterator it = diagsites.find(key);
+     if (it != diagsites.end())
+          return it->second;
+
+     DiagSite *d = new DiagSite();
+     d->addr = addr;
+     d->msg = msg;
+     d->count = 0;
+     diagsites.insert(make_pair(key, d));
+     return d;
+}
+
+void diagHit(DiagSite *d)
+{
+     d->count.fetch_add(1, memory_order_relaxed);
+     if (diaglog != NULL) {
+          lock_guard<mutex> lock(diagmutex);
+          fprintf(diaglog, "%x: %s\n", d->addr, d->msg.c_str());
+     }
+}
+
+void diag(uint32_t addr, string msg)
+{
+     diagHit(getDiagSite(addr, msg));
+}
+
+int openDiagLog(const char *filename)
+{
+     diaglog = fopen(filename, "w");
+     if (diaglog == NULL) return 1;
+
+     setvbuf(diaglog, NULL, _IOFBF, 1 << 20);
+     return 0;
+}
+
+bool moreHits(DiagSite *a, DiagSite *b)
+{
+     if (a->count != b->count) return a->count > b->count;
+     if (a->addr != b->addr) return a->addr < b->addr;
+     return a->msg < b->msg;
+}
+
+void printDiagSummary()
+{
+     if (diaglog != NULL) {
+          fclose(diaglog);
+          diaglog = NULL;
+     }
+     if (diagsites.empty()) return;
+
+     vector<DiagSite*> v;
+     for (map< pair<uint32_t, string>, DiagSite* >::iterator it = diagsites.begin(); it != diagsites.end(); ++it) {
+          v.push_back(it->second);
+     }
+     sort(v.begin(), v.end(), moreHits);
+
+     printf("diagnostics:\n");
+     for (vector<DiagSite*>::iterator it = v.begin(); it != v.end(); ++it) {
+          if ((*it)->addr != 0)
+               printf("%10lu  %8x  %s\n", (unsigned long)(*it)->count, (*it)->addr, (*it)->msg.c_str());
+          else
+               printf("%10lu  %8s  %s\n", (unsigned long)(*it)->count, "-", (*it)->msg.c_str());
+     }
+}
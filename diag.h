@@ -0,0 +1,14 @@
+// Diagnostics of the symbolic execution, counted per static instruction
+//
+// A message reported at an instruction address is counted instead of being
+// printed for every dynamic occurrence. The counts are printed sorted at the
+// end of the run, and every occurrence goes to the verbose log if one is open.
+// Messages not tied to an instruction use the address 0.
+
+struct DiagSite;
+
+DiagSite *getDiagSite(uint32_t addr, string msg);
+void diagHit(DiagSite *d);
+void diag(uint32_t addr, string msg);
+int openDiagLog(const char *filename);
+void printDiagSummary();
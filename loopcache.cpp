@@ -0,0 +1,112 @@
+/*
+ * Content-addressed cache of loop bodies shared by loopdetect and llse
+ *
+ * A cache entry is a small text file named by the hash of the loop body:
+ *   loop <startaddr> <length>
+ *   verdict <reference hash> <result>
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace std;
+
+#include "core.h"
+#include "loopcache.h"
+
+// FNV-1a hash of the disassembly of every instruction in [begin, end) and of
+// the alias class of every memory access, the accesses to one address are in
+// one class, numbered in the order of their first access
+uint64_t loopBodyHash(list<Inst>::iterator begin, list<Inst>::iterator end)
+{
+     uint64_t h = 14695981039346656037ull;
+     unordered_map<uint32_t, uint32_t> alias;
+     for (list<Inst>::iterator it = begin; it != end; ++it) {
+          for (string::iterator c = it->assembly.begin(); c != it->assembly.end(); ++c) {
+               h ^= (unsigned char)*c;
+               h *= 1099511628211ull;
+          }
+          if (it->memaddr != 0) {
+               uint32_t cls = alias.insert(make_pair(it->memaddr, (uint32_t)alias.size())).first->second;
+               for (int i = 0; i < 4; ++i) {
+                    h ^= (cls >> (8 * i)) & 0xff;
+                    h *= 1099511628211ull;
+               }
+          }
+          h ^= '\n';
+          h *= 1099511628211ull;
+     }
+
+     return h;
+}
+
+// continue the FNV-1a hash h with the characters of s
+uint64_t extendHash(uint64_t h, string s)
+{
+     for (string::iterator c = s.begin(); c != s.end(); ++c) {
+          h ^= (unsigned char)*c;
+          h *= 1099511628211ull;
+     }
+
+     return h;
+}
+
+string cacheFileName(const char *dir, uint64_t hash)
+{
+     char buf[32];
+     snprintf(buf, sizeof(buf), "/%016llx", (unsigned long long)hash);
+     return string(dir) + buf;
+}
+
+bool loadCacheEntry(const char *dir, uint64_t hash, LoopCacheEntry *e)
+{
+     ifstream infile(cacheFileName(dir, hash));
+     if (!infile.is_open()) return false;
+
+     e->hash = hash;
+     e->startaddr = 0;
+     e->length = 0;
+     e->verdict.clear();
+
+     string line, tag, temp;
+     while (getline(infile, line)) {
+          istringstream strbuf(line);
+          strbuf >> tag;
+          if (tag == "loop") {
+               strbuf >> temp >> e->length;
+               e->startaddr = stoul(temp, 0, 16);
+          } else if (tag == "verdict") {
+               strbuf >> temp;
+               uint64_t ref = stoull(temp, 0, 16);
+               getline(strbuf >> ws, e->verdict[ref]);
+          }
+     }
+
+     return true;
+}
+
+int storeCacheEntry(const char *dir, LoopCacheEntry *e)
+{
+     mkdir(dir, 0755);
+
+     FILE *fp = fopen(cacheFileName(dir, e->hash).c_str(), "w");
+     if (fp == NULL) return 1;
+
+     fprintf(fp, "loop %x %d\n", e->startaddr, e->length);
+     for (map<uint64_t, string>::iterator it = e->verdict.begin(); it != e->verdict.end(); ++it) {
+          fprintf(fp, "verdict %016llx %s\n", (unsigned long long)it->first, it->second.c_str());
+     }
+
+     fclose(fp);
+     return 0;
+}
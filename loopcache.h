@@ -0,0 +1,17 @@
+// Persistent cache of analyzed loop bodies
+//
+// Every loop body is identified by a hash of its static instruction sequence.
+// The cache directory holds one file per hash recording where the body was
+// detected and the llse verdicts against reference loops.
+
+struct LoopCacheEntry {
+     uint64_t hash;
+     unsigned int startaddr;    // start address of the loop when first detected
+     int length;                // number of instructions in the body
+     map<uint64_t, string> verdict; // reference loop hash -> llse verdict
+};
+
+uint64_t loopBodyHash(list<Inst>::iterator begin, list<Inst>::iterator end);
+uint64_t extendHash(uint64_t h, string s);
+bool loadCacheEntry(const char *dir, uint64_t hash, LoopCacheEntry *e);
+int storeCacheEntry(const char *dir, LoopCacheEntry *e);
@@ -4,24 +4,37 @@
 #include <string>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <stack>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <unistd.h>
 
 using namespace std;
 
 #include "core.h"
+#include "loopfeature.h"
+#include "loopfile.h"
+#include "loopcache.h"
+#include "constscan.h"
 
 list<Inst> instlist;
+const char *loopfile = "loops.dat";  // container of all loop instances
+const char *cachedir = NULL;         // loop body cache, NULL if disabled
 
 // Data structures for identify functions
 struct FuncBody {
-     int start;
-     int end;
+     int start;                 // id of the first instruction in the callee
+     int end;                   // id of the ret instruction
      int length;                // end - start
      unsigned int startAddr;
      unsigned int endAddr;
-     int loopn;
+     int loopn;                 // number of loop bodies in this function instance
+     int depth;                 // depth in the call context tree, the root is 0
+     uint32_t esp;              // esp after the call pushed the return address
+     struct FuncBody *parent;   // caller instance
+     list<struct FuncBody *> callee; // instances called from this one
 };
 
 struct Func {
@@ -34,12 +47,29 @@ struct LoopBody {
      bool good;
      list<Inst>::iterator begin;
      list<Inst>::iterator end;
+     FuncBody *func;            // enclosing function instance
+     int consthits;             // number of crypto constant hits
 };
 
 struct Loop {
      unsigned int startaddr;
      list<LoopBody> loopbody;
      vector<LoopBody> instance;
+     struct Loop *parent;       // enclosing loop in the loop nesting forest
+     list<struct Loop *> child; // loops nested in this loop
+     int depth;                 // nesting depth, outermost loops are 0
+     set<int> consts;           // crypto constants found in the loop instances
+     int consthits;             // number of crypto constant hits in the loop instances
+     LoopFeature feature;       // features over all loop bodies
+     map<unsigned int, MemStream> streams; // memory instructions not in a nested loop
+     int lastend;               // id of the end of the last body, -1 before the first
+};
+
+// a loop body as an interval of instruction ids
+struct BodySpan {
+     int begin;
+     int end;
+     Loop *lp;
 };
 
 struct LoopSeq {           // continuous loop body
@@ -59,6 +89,27 @@ string jmpInstrName[33] = {"jo","jno","js","jns","je","jz","jne",
 set<int> *jmpset;        // jmp instructions
 map<string, int> *instenum;     // instruction enumerations
 
+map<unsigned int, Func *> *funcmap;  // callee address -> function instances
+FuncBody *calltree;                  // root of the call context tree
+vector<FuncBody *> instfunc;         // instruction id -> innermost function instance
+
+// filters on the enclosing function instance of a loop body
+set<unsigned int> funcfilter;   // callee addresses, empty means all functions
+int mindepth = 0;
+int maxdepth = -1;              // -1 means no limit
+int minfuncsize = 0;
+int maxfuncsize = -1;           // -1 means no limit
+
+// nesting level of the emitted loops
+#define NEST_ALL -1             // every loop
+#define NEST_INNERMOST -2       // loops without nested loops
+int nestlevel = NEST_ALL;       // otherwise the depth, outermost loops are 0
+
+bool printtree = false;         // print the call context tree and the loop nesting forest
+
+bool filterscore = false;       // skip loops scored below minscore
+float minscore = 0;
+
 string getOpcName(int opc, map<string, int> *m)
 {
      for (map<string, int>::iterator it = m->begin(); it != m->end(); ++it) {
@@ -103,44 +154,148 @@ void printLoop(list<Inst>::iterator begin, list<Inst>::iterator end, map<string,
 }
 
 
-map<unsigned int, list<FuncBody *> *> *
-buildFuncList(list<Inst> *L)
+FuncBody *newFuncBody(FuncBody *parent, list<Inst>::iterator entry)
 {
-     map<unsigned int, list<FuncBody *> *> *funcmap =
-          new map<unsigned int, list<FuncBody *> *>;
-     // list<Func> *funclist = new list<Func>;
-     stack<list<Inst>::iterator> stk;
+     FuncBody *fb = new FuncBody();
+     fb->start = entry->id;
+     fb->end = entry->id;
+     fb->length = 0;
+     fb->startAddr = entry->addrn;
+     fb->endAddr = entry->addrn;
+     fb->loopn = 0;
+     fb->esp = 0;
+     fb->parent = parent;
+     if (parent != NULL) {
+          fb->depth = parent->depth + 1;
+          parent->callee.push_back(fb);
+     } else {
+          fb->depth = 0;
+     }
 
+     return fb;
+}
+
+void closeFuncBody(FuncBody *fb, list<Inst>::iterator last)
+{
+     fb->end = last->id;
+     fb->endAddr = last->addrn;
+     fb->length = fb->end - fb->start;
+}
+
+// Build the call context tree of the whole trace. A call opens a new function
+// instance and a ret closes the instance whose return address slot it pops, so
+// unbalanced frames (longjmp, exceptions) are closed as well. The root of the
+// tree stands for the code the trace starts in.
+FuncBody *buildFuncList(list<Inst> *L)
+{
+     funcmap = new map<unsigned int, Func *>;
+     instfunc.assign(L->size() + 1, NULL);
+
+     if (L->empty()) return NULL;
+
+     FuncBody *root = newFuncBody(NULL, L->begin());
+     list<FuncBody *> stk;      // open function instances, the innermost at the back
+     FuncBody *cur = root;
 
      for (list<Inst>::iterator it = L->begin(); it != L->end(); ++it) {
-          // parse the whole instlist to build funclist
+          // parse the whole instlist to build the call context tree
+          instfunc[it->id] = cur;
+
+          list<Inst>::iterator ni = next(it, 1);
+          if (it->opcstr == "call" && ni != L->end()) {
+               FuncBody *fb = newFuncBody(cur, ni);
+               fb->esp = it->ctxreg[6] - 4;
 
-          if (it->opcstr == "call") {
-               stk.push(it);
                // search whether the function is in the function list
-               // if yes, identify whether it is a new function instance
                // if not, create a new function
-               map<unsigned int, list<FuncBody *> *>::iterator i = funcmap->find(it->addrn);
+               map<unsigned int, Func *>::iterator i = funcmap->find(fb->startAddr);
                if (i == funcmap->end()) {
-                    unsigned int calladdr = stoul(it->oprs[0], nullptr, 16);
-                    funcmap->insert(pair<unsigned int, list<FuncBody *> *>(calladdr, NULL));
+                    Func *f = new Func();
+                    f->callAddr = fb->startAddr;
+                    i = funcmap->insert(pair<unsigned int, Func *>(fb->startAddr, f)).first;
                }
+               i->second->body.push_back(fb);
+
+               stk.push_back(fb);
+               cur = fb;
           } else if (it->opcstr == "ret") {
-               if (!stk.empty()) stk.pop();
+               // find the instance owning the popped return address
+               list<FuncBody *>::reverse_iterator ri;
+               for (ri = stk.rbegin(); ri != stk.rend(); ++ri) {
+                    if ((*ri)->esp == it->ctxreg[6]) break;
+               }
+               if (ri == stk.rend()) continue; // returns from the root
+
+               FuncBody *target = *ri, *fb;
+               do {
+                    fb = stk.back();
+                    stk.pop_back();
+                    closeFuncBody(fb, it);
+               } while (fb != target);
+               cur = stk.empty() ? root : stk.back();
           } else {}
      }
 
-     return funcmap;
+     // close instances that are still running at the end of the trace
+     list<Inst>::iterator last = prev(L->end());
+     for (list<FuncBody *>::iterator it = stk.begin(); it != stk.end(); ++it) {
+          closeFuncBody(*it, last);
+     }
+     closeFuncBody(root, last);
+
+     return root;
 }
 
-void printFuncmap(map<unsigned int, list<FuncBody *> *> *funcmap)
+void printFuncmap(map<unsigned int, Func *> *funcmap)
 {
-     map<unsigned int, list<FuncBody *> *>::iterator it;
+     map<unsigned int, Func *>::iterator it;
      for (it = funcmap->begin(); it != funcmap->end(); ++it) {
-          cout << hex << it->first << endl;
+          cout << hex << it->first << ": " << dec << it->second->body.size() << " instances" << endl;
+     }
+}
+
+void printCallTree(FuncBody *fb)
+{
+     cout << string(2 * fb->depth, ' ');
+     cout << hex << fb->startAddr << dec << " [" << fb->start << ", " << fb->end << "] ";
+     cout << "length: " << fb->length << " loops: " << fb->loopn << endl;
+     for (list<FuncBody *>::iterator it = fb->callee.begin(); it != fb->callee.end(); ++it) {
+          printCallTree(*it);
      }
 }
 
+// the innermost function instance containing both fb1 and fb2
+FuncBody *commonFunc(FuncBody *fb1, FuncBody *fb2)
+{
+     while (fb1->depth > fb2->depth) fb1 = fb1->parent;
+     while (fb2->depth > fb1->depth) fb2 = fb2->parent;
+     while (fb1 != fb2) {
+          fb1 = fb1->parent;
+          fb2 = fb2->parent;
+     }
+
+     return fb1;
+}
+
+// check a function instance against the function filters
+bool isFuncSelected(FuncBody *fb)
+{
+     if (fb->depth < mindepth) return false;
+     if (maxdepth >= 0 && fb->depth > maxdepth) return false;
+     if (fb->length < minfuncsize) return false;
+     if (maxfuncsize >= 0 && fb->length > maxfuncsize) return false;
+
+     if (funcfilter.empty()) return true;
+
+     // the loop is selected if it runs in the call context of a selected function
+     for (FuncBody *f = fb; f != NULL; f = f->parent) {
+          if (funcfilter.find(f->startAddr) != funcfilter.end())
+               return true;
+     }
+
+     return false;
+}
+
 map<string, int> *buildOpcodeMap(list<Inst> *L)
 {
      map<string, int> *instenum = new map<string, int>;
@@ -235,24 +390,179 @@ void printLoopBody(LoopBody lpbd)
      cout << endl;
 }
 
+// write all loop instances into one indexed container file
 void outputLoopInstance(list<Loop> *loops)
 {
-     int n = 1;
-     for (list<Loop>::iterator it = loops->begin(); it != loops->end(); ++it) {
-          for (int i = 0, max = it->instance.size(); i < max; ++i) {
-               string loopfile = "loop" + to_string(n++) + ".txt";
-               FILE *fp = fopen(loopfile.c_str(), "w");
+     LoopFile *lf = createLoopFile(loopfile);
+     if (lf == NULL) {
+          fprintf(stderr, "Open file error: %s\n", loopfile);
+          return;
+     }
 
-               for (list<Inst>::iterator ii = it->instance[i].begin; ii != it->instance[i].end; ++ii) {
-                    fprintf(fp, "%s;%s;", ii->addr.c_str(), ii->assembly.c_str());
-                    for (int j = 0; j < 8; ++j) {
-                         fprintf(fp, "%x,", ii->ctxreg[j]);
+     int loopid = 1, cached = 0;
+     for (list<Loop>::iterator it = loops->begin(); it != loops->end(); ++it, ++loopid) {
+          float feature[NFEATURE];
+          getFeatureVector(&it->feature, feature);
+          for (int i = 0, max = it->instance.size(); i < max; ++i) {
+               LoopBody *bd = &it->instance[i];
+               if (cachedir != NULL) {
+                    // Record the bodies not seen in earlier traces. Every body is
+                    // still written, llse keeps its verdicts per reference and options.
+                    LoopCacheEntry e;
+                    uint64_t h = loopBodyHash(bd->begin, bd->end);
+                    if (loadCacheEntry(cachedir, h, &e)) {
+                         ++cached;
+                    } else {
+                         e.hash = h;
+                         e.startaddr = it->startaddr;
+                         e.length = distance(bd->begin, bd->end);
+                         storeCacheEntry(cachedir, &e);
                     }
-                    fprintf(fp, "%x,\n", ii->memaddr);
                }
+               writeLoopInstance(lf, loopid, i + 1, bd->begin, bd->end, bd->consthits, feature);
+          }
+     }
+
+     if (cachedir != NULL)
+          cout << cached << " loop instances already in the cache" << endl;
+     cout << "write " << lf->index.size() << " loop instances to " << loopfile << endl;
+     closeLoopFile(lf);
+}
+
+// scan the loop instances for crypto constants
+void scanLoopConsts(Loop *lp)
+{
+     lp->consts.clear();
+     lp->consthits = 0;
+     for (vector<LoopBody>::iterator it = lp->instance.begin(); it != lp->instance.end(); ++it) {
+          vector<int> hits;
+          for (list<Inst>::iterator ii = it->begin; ii != it->end; ++ii) {
+               scanInst(&*ii, &hits);
+          }
+          it->consthits = hits.size();
+          lp->consthits += hits.size();
+          lp->consts.insert(hits.begin(), hits.end());
+     }
+}
+
+// Add a body to the features of its loop as soon as it is detected. Inner
+// bodies end before the bodies enclosing them, so a memory instruction is
+// owned by the innermost loop it runs in and only tracked by that loop; the
+// strides of a stream are taken within runs of consecutive bodies.
+void addBodyFeature(Loop *lp, LoopBody *bd, unordered_map<unsigned int, Loop *> *owner)
+{
+     if (lp->lastend >= 0 && bd->begin->id != lp->lastend + 1)
+          breakLoopFeature(&lp->streams);
+     lp->lastend = bd->end->id;
+
+     for (list<Inst>::iterator it = bd->begin; it != bd->end; ++it) {
+          addInstFeature(&lp->feature, &*it);
+          if (it->memaddr == 0) continue;
+
+          Loop *&o = (*owner)[it->addrn];
+          if (o == NULL) o = lp;
+          if (o == lp) addMemAccess(&lp->streams, &*it);
+     }
+}
+
+// classify the streams of a loop and add the streams of its nested loops
+void finishLoop(Loop *lp)
+{
+     finishLoopFeature(&lp->feature, &lp->streams);
+     for (list<Loop *>::iterator it = lp->child.begin(); it != lp->child.end(); ++it) {
+          finishLoop(*it);
+          addNestedFeature(&lp->feature, &(*it)->feature);
+     }
+}
+
+// loops with more distinct crypto constants are analyzed first
+bool sortconsts(const Loop &lp1, const Loop &lp2)
+{
+     if (lp1.consts.size() != lp2.consts.size())
+          return lp1.consts.size() > lp2.consts.size();
+     else
+          return lp1.consthits > lp2.consthits;
+}
+
+bool sortspan(BodySpan s1, BodySpan s2)
+{
+     if (s1.begin != s2.begin)
+          return s1.begin < s2.begin;
+     else
+          return s1.end > s2.end;
+}
+
+// Build the loop nesting forest from the dynamic loop bodies. A loop is nested
+// in another loop if its bodies run inside the bodies of that loop; its parent
+// is the loop whose bodies enclose it directly most often.
+void buildLoopForest(list<Loop> *loops)
+{
+     vector<BodySpan> spans;
+     for (list<Loop>::iterator it = loops->begin(); it != loops->end(); ++it) {
+          it->parent = NULL;
+          it->child.clear();
+          it->depth = 0;
+          for (list<LoopBody>::iterator ii = it->loopbody.begin(); ii != it->loopbody.end(); ++ii) {
+               BodySpan sp = {ii->begin->id, ii->end->id, &*it};
+               spans.push_back(sp);
+          }
+     }
+     sort(spans.begin(), spans.end(), sortspan);
+
+     // count how often each loop is directly enclosed by another loop
+     map<Loop *, map<Loop *, int> > encl;
+     vector<BodySpan> stk;
+     for (vector<BodySpan>::iterator it = spans.begin(); it != spans.end(); ++it) {
+          while (!stk.empty() && stk.back().end < it->begin) stk.pop_back();
+
+          for (vector<BodySpan>::reverse_iterator ri = stk.rbegin(); ri != stk.rend(); ++ri) {
+               if (ri->end >= it->end && ri->lp != it->lp) {
+                    ++encl[it->lp][ri->lp];
+                    break;
+               }
+          }
+          stk.push_back(*it);
+     }
 
-               fclose(fp);
+     for (map<Loop *, map<Loop *, int> >::iterator it = encl.begin(); it != encl.end(); ++it) {
+          Loop *parent = NULL;
+          int n = 0;
+          for (map<Loop *, int>::iterator ii = it->second.begin(); ii != it->second.end(); ++ii) {
+               if (ii->second > n) {
+                    parent = ii->first;
+                    n = ii->second;
+               }
           }
+
+          // do not create a cycle in the forest
+          Loop *p;
+          for (p = parent; p != NULL && p != it->first; p = p->parent) ;
+          if (p == NULL) it->first->parent = parent;
+     }
+
+     for (list<Loop>::iterator it = loops->begin(); it != loops->end(); ++it) {
+          if (it->parent != NULL) it->parent->child.push_back(&*it);
+          for (Loop *p = it->parent; p != NULL; p = p->parent) ++it->depth;
+     }
+}
+
+// check whether a loop is emitted at the chosen nesting level
+bool isLoopSelected(Loop *lp)
+{
+     if (nestlevel == NEST_ALL)
+          return true;
+     else if (nestlevel == NEST_INNERMOST)
+          return lp->child.empty();
+     else                       // loops shallower than the level are kept if nothing is nested in them
+          return lp->depth == nestlevel || (lp->depth < nestlevel && lp->child.empty());
+}
+
+void printLoopForest(Loop *lp)
+{
+     cout << string(2 * lp->depth, ' ') << hex << lp->startaddr << dec;
+     cout << " bodies: " << lp->loopbody.size() << endl;
+     for (list<Loop *>::iterator it = lp->child.begin(); it != lp->child.end(); ++it) {
+          printLoopForest(*it);
      }
 }
 
@@ -262,6 +572,8 @@ void loopdetect1(list<Inst> *L)
      int nloop = 0;
      // set<pair<unsigned int, unsigned int> > loops;
      list<Loop> loops;
+     unordered_map<unsigned int, Loop *> owner; // memory instruction -> innermost loop it runs in
+     int filtered = 0;                          // loop bodies in filtered functions
      for (list<Inst>::iterator it = L->begin(); it != L->end(); ++it) {
           if (isjump(it->opc, jmpset)) {
                unsigned int targetaddr = stoul(it->oprs[0], 0, 16);
@@ -273,6 +585,26 @@ void loopdetect1(list<Inst> *L)
                     LoopBody bd;
                     bd.end = it;
 
+                    // a loop body is good, if its size is less than 0xffff
+                    int n = 0;
+                    bd.good = false;
+                    for (list<Inst>::iterator i = bd.end; n < 0xffff; --i, ++n) {
+                         if (i->addrn == targetaddr) {
+                              bd.begin = i;
+                              bd.good = true;
+                              break;
+                         }
+                    }
+                    if (!bd.good) continue;
+
+                    // attribute the loop body to its enclosing function instance
+                    bd.func = commonFunc(instfunc[bd.begin->id], instfunc[bd.end->id]);
+                    if (!isFuncSelected(bd.func)) {
+                         ++filtered;
+                         continue;
+                    }
+                    ++bd.func->loopn;
+
                     list<Loop>::iterator ii;
                     for (ii = loops.begin(); ii != loops.end(); ++ii) {
                          if (ii->startaddr == targetaddr) break;
@@ -280,72 +612,56 @@ void loopdetect1(list<Inst> *L)
                     if (ii == loops.end()) { // A new loop
                          Loop lp;
                          lp.startaddr = targetaddr;
-                         lp.loopbody.push_back(bd);
+                         lp.lastend = -1;
+                         initLoopFeature(&lp.feature);
                          loops.push_back(lp);
-                    } else {    // The loop aready exists. Add a new loop body.
-                         ii->loopbody.push_back(bd);
+                         ii = prev(loops.end());
                     }
+                    // Add a new loop body.
+                    ii->loopbody.push_back(bd);
+                    addBodyFeature(&*ii, &ii->loopbody.back(), &owner);
                     ++nloop;
                }
           }
      }
+     cout << "num of filtered loop bodies: " << filtered << endl;
 
-     // a loop body is good, if its size is less than 0xffff
+     int goodbodies = 0;
      for (list<Loop>::iterator it = loops.begin(); it != loops.end(); ++it) {
           for (list<LoopBody>::iterator ii = it->loopbody.begin(); ii != it->loopbody.end(); ++ii) {
-               int n = 0;
-               for (list<Inst>::iterator i = ii->end; n < 0xffff; --i, ++n) {
-                    if (i->addrn == it->startaddr) {
-                         ii->begin = i;
-                         ii->good = true;
-                         break;
-                    }
-               }
-               if (n == 0xffff) {
-                    ii -> good = false;
-                    // cout << "no begin address found!" << endl;
-                    // cout << "id: " << dec << ii->end->id;
-                    // cout << ", end address: " << hex << ii->end->addrn << endl;
+               if (ii->good == true) {
+                    ++goodbodies;
+                    //printLoop(ii->begin, ii->end, instenum);
                }
           }
      }
 
-     cout << "remove all bad loop bodies." << endl;
-     // remove all bad loop bodies
+
+     // cout << "nloop = " << nloop << endl;
+     cout << "num of loops: " << loops.size() << endl;
+     // cout << "num of goodbodies = " << goodbodies << endl;
+
+     buildLoopForest(&loops);
      for (list<Loop>::iterator it = loops.begin(); it != loops.end(); ++it) {
-          for (list<LoopBody>::iterator ii = it->loopbody.begin(); ii != it->loopbody.end();) {
-               if (ii->good == false) {
-                    ii = it->loopbody.erase(ii);
-               } else {
-                    ++ii;
-               }
+          if (it->parent == NULL) finishLoop(&*it);
+     }
+     if (printtree) {
+          cout << "loop nesting forest:" << endl;
+          for (list<Loop>::iterator it = loops.begin(); it != loops.end(); ++it) {
+               if (it->parent == NULL) printLoopForest(&*it);
           }
      }
 
-     cout << "remove loops that have no loop body. " << endl;
-     // remove loops that have no loop body
+     // keep only the loops at the chosen nesting level, so that the same
+     // instructions are not emitted again inside every enclosing loop
      for (list<Loop>::iterator it = loops.begin(); it != loops.end();) {
-          if (it->loopbody.size() == 0) {
+          if (!isLoopSelected(&*it)) {
                it = loops.erase(it);
           } else {
                ++it;
           }
      }
-
-     int goodbodies = 0;
-     for (list<Loop>::iterator it = loops.begin(); it != loops.end(); ++it) {
-          for (list<LoopBody>::iterator ii = it->loopbody.begin(); ii != it->loopbody.end(); ++ii) {
-               if (ii->good == true) {
-                    ++goodbodies;
-                    //printLoop(ii->begin, ii->end, instenum);
-               }
-          }
-     }
-
-
-     // cout << "nloop = " << nloop << endl;
-     cout << "num of loops: " << loops.size() << endl;
-     // cout << "num of goodbodies = " << goodbodies << endl;
+     cout << "num of loops at the nesting level: " << loops.size() << endl;
 
 
      // remove repeated loop bodies. Create loop instance list
@@ -365,10 +681,47 @@ void loopdetect1(list<Inst> *L)
           }
      }
 
+     // skip loops that do not look like crypto by their features
+     for (list<Loop>::iterator it = loops.begin(); it != loops.end();) {
+          if (filterscore && it->feature.score < minscore) {
+               it = loops.erase(it);
+          } else {
+               ++it;
+          }
+     }
+     if (filterscore)
+          cout << "num of loops above the feature score: " << loops.size() << endl;
+
+     // rank loops by the crypto constants in their instances
+     for (list<Loop>::iterator it = loops.begin(); it != loops.end(); ++it) {
+          scanLoopConsts(&*it);
+     }
+     loops.sort(sortconsts);
+
      // print loop information
      for (list<Loop>::iterator it = loops.begin(); it != loops.end(); ++it) {
+          set<FuncBody *> funcs;
+          for (list<LoopBody>::iterator ii = it->loopbody.begin(); ii != it->loopbody.end(); ++ii) {
+               funcs.insert(ii->func);
+          }
+          cout << "loop " << hex << it->startaddr << " in function ";
+          cout << it->loopbody.front().func->startAddr << dec;
+          cout << " (" << funcs.size() << " function instances)";
+          cout << " nesting depth " << it->depth << endl;
           cout << " loop body nums: " << dec << it->loopbody.size() << endl;
           cout << " loop instance nums: " << it->instance.size() << endl;
+          printLoopFeature(&it->feature);
+          if (!it->consts.empty()) {
+               cout << " crypto constants: " << it->consthits << " hits";
+               set<string> names;
+               for (set<int>::iterator ii = it->consts.begin(); ii != it->consts.end(); ++ii) {
+                    names.insert(getConstName(*ii));
+               }
+               for (set<string>::iterator ii = names.begin(); ii != names.end(); ++ii) {
+                    cout << " " << *ii;
+               }
+               cout << endl;
+          }
           // for (int i = 0, max = it->instance.size(); i < max; ++i) {
           //      printLoopBody(it->instance[i]);
           // }
@@ -472,13 +825,84 @@ void parseTrace(ifstream *infile, list<Inst> *L)
      }
 }
 
+void usage(char *prog)
+{
+     fprintf(stderr, "usage: %s [options] <tracefile>\n", prog);
+     fprintf(stderr, "  -c <addr>   only keep loops called from the function at addr (repeatable)\n");
+     fprintf(stderr, "  -d <depth>  maximum call depth of the enclosing function\n");
+     fprintf(stderr, "  -D <depth>  minimum call depth of the enclosing function\n");
+     fprintf(stderr, "  -s <size>   minimum length of the enclosing function instance\n");
+     fprintf(stderr, "  -S <size>   maximum length of the enclosing function instance\n");
+     fprintf(stderr, "  -t          print the call context tree and the loop nesting forest\n");
+     fprintf(stderr, "  -o <file>   loop instance container (default: loops.dat)\n");
+     fprintf(stderr, "  -n <level>  emit loops at a nesting level: all (default), inner, outer or a depth\n");
+     fprintf(stderr, "  -C <dir>    record loop bodies in the cache directory\n");
+     fprintf(stderr, "  -k <file>   add crypto constants and table ranges to the dictionary\n");
+     fprintf(stderr, "  -f <score>  skip loops whose feature score is below score\n");
+}
+
 int main(int argc, char **argv) {
-     if (argc != 2) {
-          fprintf(stderr, "usage: %s <tracefile>\n", argv[0]);
+     int opt;
+
+     initConstDict();
+     while ((opt = getopt(argc, argv, "c:d:D:s:S:to:n:C:k:f:")) != -1) {
+          switch (opt) {
+          case 'c':
+               funcfilter.insert(stoul(optarg, 0, 16));
+               break;
+          case 'd':
+               maxdepth = stoi(optarg);
+               break;
+          case 'D':
+               mindepth = stoi(optarg);
+               break;
+          case 's':
+               minfuncsize = stoi(optarg);
+               break;
+          case 'S':
+               maxfuncsize = stoi(optarg);
+               break;
+          case 't':
+               printtree = true;
+               break;
+          case 'o':
+               loopfile = optarg;
+               break;
+          case 'C':
+               cachedir = optarg;
+               break;
+          case 'f':
+               filterscore = true;
+               minscore = stof(optarg);
+               break;
+          case 'k':
+               if (loadConstDict(optarg) != 0) {
+                    fprintf(stderr, "Open file error: %s\n", optarg);
+                    return 1;
+               }
+               break;
+          case 'n':
+               if (string(optarg) == "all")
+                    nestlevel = NEST_ALL;
+               else if (string(optarg) == "inner")
+                    nestlevel = NEST_INNERMOST;
+               else if (string(optarg) == "outer")
+                    nestlevel = 0;
+               else
+                    nestlevel = stoi(optarg);
+               break;
+          default:
+               usage(argv[0]);
+               return 1;
+          }
+     }
+
+     if (argc - optind != 1) {
+          usage(argv[0]);
           return 1;
      }
 
-     ifstream infile(argv[1]);
+     ifstream infile(argv[optind]);
      if (!infile.is_open()) {
           fprintf(stderr, "Open file error!\n");
           return 1;
@@ -490,7 +914,14 @@ int main(int argc, char **argv) {
 
      preprocess(&instlist);
 
+     calltree = buildFuncList(&instlist);
+
      loopdetect1(&instlist);
 
+     if (printtree && calltree != NULL) {
+          printCallTree(calltree);
+          printFuncmap(funcmap);
+     }
+
      return 0;
 }
@@ -0,0 +1,178 @@
+/*
+ * Loop feature vectors used by loopdetect to triage loop candidates
+ *
+ * 1. Opcode class histogram: xor, shift, rotate and arithmetic ratios
+ * 2. Memory access stride of each static memory instruction
+ * 3. Data dependent table lookups
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#include "core.h"
+#include "loopfeature.h"
+
+map<string, int> opcclass = {
+     {"xor", OPC_XOR}, {"pxor", OPC_XOR}, {"xorps", OPC_XOR},
+     {"shl", OPC_SHIFT}, {"shr", OPC_SHIFT}, {"sal", OPC_SHIFT}, {"sar", OPC_SHIFT},
+     {"shld", OPC_SHIFT}, {"shrd", OPC_SHIFT},
+     {"rol", OPC_ROTATE}, {"ror", OPC_ROTATE}, {"rcl", OPC_ROTATE}, {"rcr", OPC_ROTATE},
+     {"add", OPC_ADD}, {"sub", OPC_ADD}, {"adc", OPC_ADD}, {"sbb", OPC_ADD},
+     {"inc", OPC_ADD}, {"dec", OPC_ADD}, {"neg", OPC_ADD},
+     {"mul", OPC_MUL}, {"imul", OPC_MUL}, {"div", OPC_MUL}, {"idiv", OPC_MUL},
+     {"and", OPC_LOGIC}, {"or", OPC_LOGIC}, {"not", OPC_LOGIC}, {"test", OPC_LOGIC},
+     {"bswap", OPC_LOGIC},
+     {"mov", OPC_MOV}, {"movzx", OPC_MOV}, {"movsx", OPC_MOV}, {"lea", OPC_MOV},
+     {"push", OPC_MOV}, {"pop", OPC_MOV}, {"xchg", OPC_MOV},
+     {"movsb", OPC_MOV}, {"movsd", OPC_MOV}, {"stosb", OPC_MOV}, {"stosd", OPC_MOV},
+     {"cmp", OPC_CTRL}, {"call", OPC_CTRL}, {"ret", OPC_CTRL}, {"cmpsb", OPC_CTRL},
+     {"scasb", OPC_CTRL}
+};
+
+// table lookups read within a small window, e.g. an AES T-table or an S-box
+#define TABLE_SPAN 0x10000
+
+int getOpcClass(string opcstr)
+{
+     map<string, int>::iterator it = opcclass.find(opcstr);
+     if (it != opcclass.end())
+          return it->second;
+     else if (opcstr[0] == 'j' || opcstr.compare(0, 3, "set") == 0 || opcstr.compare(0, 4, "loop") == 0)
+          return OPC_CTRL;
+     else if (opcstr.compare(0, 4, "cmov") == 0)
+          return OPC_MOV;
+     else
+          return OPC_OTHER;
+}
+
+void initLoopFeature(LoopFeature *f)
+{
+     f->ninst = 0;
+     for (int i = 0; i < NOPCLASS; ++i) {
+          f->nclass[i] = 0;
+     }
+     f->nstream = 0;
+     f->nconst = 0;
+     f->nstrided = 0;
+     f->nirregular = 0;
+     f->ntable = 0;
+     f->score = 0;
+}
+
+// add an instruction of a loop body to the opcode class histogram
+void addInstFeature(LoopFeature *f, Inst *ins)
+{
+     ++f->ninst;
+     ++f->nclass[getOpcClass(ins->opcstr)];
+}
+
+// add the memory access of an instruction to the stream of its address
+void addMemAccess(map<unsigned int, MemStream> *streams, Inst *ins)
+{
+     map<unsigned int, MemStream>::iterator i = streams->find(ins->addrn);
+     if (i == streams->end()) {
+          MemStream ms = {1, 0, ins->memaddr, ins->memaddr, ins->memaddr, ins->memaddr, 0, true, true};
+          streams->insert(make_pair(ins->addrn, ms));
+          return;
+     }
+
+     MemStream *ms = &i->second;
+     if (ms->inrun) {
+          int64_t stride = (int64_t)ins->memaddr - ms->last;
+          if (ms->nstride == 0)
+               ms->stride = stride;
+          else if (stride != ms->stride)
+               ms->regular = false;
+          ++ms->nstride;
+     }
+     ++ms->n;
+     ms->last = ins->memaddr;
+     ms->inrun = true;
+     if (ins->memaddr < ms->minaddr) ms->minaddr = ins->memaddr;
+     if (ins->memaddr > ms->maxaddr) ms->maxaddr = ins->memaddr;
+}
+
+// the next body does not follow the last one, start new runs of all streams
+void breakLoopFeature(map<unsigned int, MemStream> *streams)
+{
+     for (map<unsigned int, MemStream>::iterator it = streams->begin(); it != streams->end(); ++it) {
+          it->second.inrun = false;
+     }
+}
+
+// classify the memory streams and score the loop
+void finishLoopFeature(LoopFeature *f, map<unsigned int, MemStream> *streams)
+{
+     for (map<unsigned int, MemStream>::iterator it = streams->begin(); it != streams->end(); ++it) {
+          MemStream *ms = &it->second;
+          if (ms->nstride == 0) continue;
+
+          ++f->nstream;
+          if (ms->regular && ms->stride == 0) {
+               ++f->nconst;
+          } else if (ms->regular) {
+               ++f->nstrided;
+          } else {
+               ++f->nirregular;
+               if (ms->maxaddr - ms->minaddr < TABLE_SPAN) ++f->ntable;
+          }
+     }
+
+     f->score = loopscore(f);
+}
+
+// add the memory streams of a nested loop to an enclosing loop and rescore it
+void addNestedFeature(LoopFeature *f, LoopFeature *inner)
+{
+     f->nstream += inner->nstream;
+     f->nconst += inner->nconst;
+     f->nstrided += inner->nstrided;
+     f->nirregular += inner->nirregular;
+     f->ntable += inner->ntable;
+     f->score = loopscore(f);
+}
+
+void getFeatureVector(LoopFeature *f, float *v)
+{
+     v[FEAT_XOR] = f->ratio(OPC_XOR);
+     v[FEAT_SHIFT] = f->ratio(OPC_SHIFT);
+     v[FEAT_ROTATE] = f->ratio(OPC_ROTATE);
+     v[FEAT_ADD] = f->ratio(OPC_ADD);
+     v[FEAT_STRIDED] = f->nstream == 0 ? 0 : (float)f->nstrided / f->nstream;
+     v[FEAT_IRREGULAR] = f->nstream == 0 ? 0 : (float)f->nirregular / f->nstream;
+     v[FEAT_TABLE] = f->ntable;
+     v[FEAT_SCORE] = f->score;
+}
+
+void printLoopFeature(LoopFeature *f)
+{
+     printf(" features: xor %.2f shift %.2f rotate %.2f add %.2f mul %.2f logic %.2f mov %.2f ctrl %.2f",
+            f->ratio(OPC_XOR), f->ratio(OPC_SHIFT), f->ratio(OPC_ROTATE), f->ratio(OPC_ADD),
+            f->ratio(OPC_MUL), f->ratio(OPC_LOGIC), f->ratio(OPC_MOV), f->ratio(OPC_CTRL));
+     printf(" mem const %d strided %d irregular %d table %d score %.2f\n",
+            f->nconst, f->nstrided, f->nirregular, f->ntable, f->score);
+}
+
+// Crypto loops are rich in bit operations and table lookups, while memcpy or
+// string compare loops only move, compare and walk memory with a fixed stride.
+float cryptoScore(LoopFeature *f)
+{
+     float bitops = f->ratio(OPC_XOR) + f->ratio(OPC_SHIFT) + f->ratio(OPC_ROTATE);
+     float arith = f->ratio(OPC_ADD) + f->ratio(OPC_MUL) + f->ratio(OPC_LOGIC);
+     float score = 2 * bitops + 0.5 * arith;
+
+     if (f->ntable > 0) score += 0.5;
+     if (f->nstream > 0 && f->nstrided == f->nstream && bitops == 0) score -= 0.5;
+
+     return score;
+}
+
+float (*loopscore)(LoopFeature *f) = cryptoScore;
@@ -0,0 +1,55 @@
+// Loop feature vectors
+//
+// Cheap features of a loop accumulated while its dynamic bodies are detected,
+// used to triage loops before symbolic execution: the opcode class histogram,
+// the stride pattern of every static memory instruction, and data dependent
+// table lookups. A memory instruction is tracked by the innermost loop it runs
+// in, an enclosing loop adds the stream counts of its nested loops.
+
+enum OpcClass {OPC_XOR, OPC_SHIFT, OPC_ROTATE, OPC_ADD, OPC_MUL, OPC_LOGIC,
+               OPC_MOV, OPC_CTRL, OPC_OTHER, NOPCLASS};
+
+// layout of the feature vector stored with every loop instance
+enum FeatureIdx {FEAT_XOR, FEAT_SHIFT, FEAT_ROTATE, FEAT_ADD,
+                 FEAT_STRIDED, FEAT_IRREGULAR, FEAT_TABLE, FEAT_SCORE, NFEATURE};
+
+// Address sequence of a static memory instruction across the loop bodies.
+// Strides are only taken within a run of consecutive bodies, the gap between
+// two runs, e.g. two calls of the loop, is not a stride.
+struct MemStream {
+     int n;                     // number of accesses
+     int nstride;               // number of strides within runs
+     uint32_t first;
+     uint32_t last;
+     uint32_t minaddr;
+     uint32_t maxaddr;
+     int64_t stride;            // first stride within a run
+     bool regular;              // all strides are equal so far
+     bool inrun;                // the next access continues the run of last
+};
+
+struct LoopFeature {
+     int ninst;                 // number of dynamic instructions
+     int nclass[NOPCLASS];      // opcode class histogram
+     int nstream;               // static memory instructions with a stride
+     int nconst;                // streams with a fixed address
+     int nstrided;              // streams with a constant non-zero stride
+     int nirregular;            // streams with data dependent addresses
+     int ntable;                // irregular streams within a small table
+     float score;
+
+     float ratio(int c) { return ninst == 0 ? 0 : (float)nclass[c] / ninst; }
+};
+
+int getOpcClass(string opcstr);
+void initLoopFeature(LoopFeature *f);
+void addInstFeature(LoopFeature *f, Inst *ins);
+void addMemAccess(map<unsigned int, MemStream> *streams, Inst *ins);
+void breakLoopFeature(map<unsigned int, MemStream> *streams);
+void finishLoopFeature(LoopFeature *f, map<unsigned int, MemStream> *streams);
+void addNestedFeature(LoopFeature *f, LoopFeature *inner);
+void getFeatureVector(LoopFeature *f, float *v);
+void printLoopFeature(LoopFeature *f);
+
+float cryptoScore(LoopFeature *f);
+extern float (*loopscore)(LoopFeature *f);   // scoring hook, cryptoScore by default
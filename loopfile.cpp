@@ -0,0 +1,227 @@
+/*
+ * Loop instance container shared by loopdetect and llse
+ *
+ * loopdetect writes all loop instances of a trace into one indexed file,
+ * llse reads a single instance back by its id without parsing the text trace.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#include "core.h"
+#include "loopfeature.h"
+#include "loopfile.h"
+
+// FNV-1a hash of the opcode sequence in [begin, end)
+uint32_t opcodeFingerprint(list<Inst>::iterator begin, list<Inst>::iterator end)
+{
+     uint32_t h = 2166136261u;
+     for (list<Inst>::iterator it = begin; it != end; ++it) {
+          for (string::iterator c = it->opcstr.begin(); c != it->opcstr.end(); ++c) {
+               h ^= (unsigned char)*c;
+               h *= 16777619u;
+          }
+          h ^= ';';
+          h *= 16777619u;
+     }
+
+     return h;
+}
+
+LoopFile *createLoopFile(const char *filename)
+{
+     FILE *fp = fopen(filename, "wb");
+     if (fp == NULL) return NULL;
+
+     LoopFile *lf = new LoopFile();
+     lf->fp = fp;
+     lf->hdr.magic = LOOPFILE_MAGIC;
+     lf->hdr.version = LOOPFILE_VERSION;
+     lf->hdr.ninst = 0;
+     lf->hdr.nentry = 0;
+     lf->hdr.instoff = 0;
+     lf->hdr.indexoff = 0;
+
+     // the header is rewritten when the file is closed
+     fwrite(&lf->hdr, sizeof(LoopFileHeader), 1, fp);
+
+     return lf;
+}
+
+void writeLoopInstance(LoopFile *lf, uint32_t loopid, uint32_t instance,
+                       list<Inst>::iterator begin, list<Inst>::iterator end,
+                       uint32_t consthits, const float *feature)
+{
+     LoopIndexEntry e;
+     e.loopid = loopid;
+     e.startaddr = begin->addrn;
+     e.instance = instance;
+     e.length = 0;
+     e.offset = ftell(lf->fp);
+     e.fingerprint = opcodeFingerprint(begin, end);
+     e.consthits = consthits;
+     for (int i = 0; i < NFEATURE; ++i) {
+          e.feature[i] = feature[i];
+     }
+
+     for (list<Inst>::iterator it = begin; it != end; ++it) {
+          InstRecord r;
+          pair<uint32_t, string> key(it->addrn, it->assembly);
+          map<pair<uint32_t, string>, uint32_t>::iterator i = lf->instidx.find(key);
+          if (i == lf->instidx.end()) {
+               i = lf->instidx.insert(make_pair(key, (uint32_t)lf->insts.size())).first;
+               Inst si;
+               si.addrn = it->addrn;
+               si.assembly = it->assembly;
+               lf->insts.push_back(si);
+          }
+          r.sidx = i->second;
+          for (int j = 0; j < 8; ++j) {
+               r.ctxreg[j] = it->ctxreg[j];
+          }
+          r.memaddr = it->memaddr;
+
+          fwrite(&r, sizeof(InstRecord), 1, lf->fp);
+          ++e.length;
+     }
+
+     lf->index.push_back(e);
+}
+
+void closeLoopFile(LoopFile *lf)
+{
+     FILE *fp = lf->fp;
+
+     // static instruction table: address, length of the disassembly, disassembly
+     lf->hdr.instoff = ftell(fp);
+     lf->hdr.ninst = lf->insts.size();
+     for (vector<Inst>::iterator it = lf->insts.begin(); it != lf->insts.end(); ++it) {
+          uint32_t len = it->assembly.size();
+          fwrite(&it->addrn, sizeof(uint32_t), 1, fp);
+          fwrite(&len, sizeof(uint32_t), 1, fp);
+          fwrite(it->assembly.data(), 1, len, fp);
+     }
+
+     lf->hdr.indexoff = ftell(fp);
+     lf->hdr.nentry = lf->index.size();
+     if (!lf->index.empty())
+          fwrite(&lf->index[0], sizeof(LoopIndexEntry), lf->index.size(), fp);
+
+     fseek(fp, 0, SEEK_SET);
+     fwrite(&lf->hdr, sizeof(LoopFileHeader), 1, fp);
+
+     fclose(fp);
+     delete lf;
+}
+
+// split the disassembly into the opcode and operand strings, the same way as parseTrace
+void parseAssembly(Inst *ins)
+{
+     string temp;
+     istringstream disasbuf(ins->assembly);
+     getline(disasbuf, ins->opcstr, ' ');
+
+     while (disasbuf.good()) {
+          getline(disasbuf, temp, ',');
+          if (temp.find_first_not_of(' ') != string::npos)
+               ins->oprs.push_back(temp);
+     }
+     ins->oprnum = ins->oprs.size();
+}
+
+LoopFile *openLoopFile(const char *filename)
+{
+     FILE *fp = fopen(filename, "rb");
+     if (fp == NULL) return NULL;
+
+     LoopFile *lf = new LoopFile();
+     lf->fp = fp;
+     if (fread(&lf->hdr, sizeof(LoopFileHeader), 1, fp) != 1 ||
+         lf->hdr.magic != LOOPFILE_MAGIC || lf->hdr.version != LOOPFILE_VERSION) {
+          fclose(fp);
+          delete lf;
+          return NULL;
+     }
+
+     // static instructions are parsed once for all instances
+     fseek(fp, lf->hdr.instoff, SEEK_SET);
+     lf->insts.resize(lf->hdr.ninst);
+     for (uint32_t i = 0; i < lf->hdr.ninst; ++i) {
+          Inst *si = &lf->insts[i];
+          uint32_t len;
+          fread(&si->addrn, sizeof(uint32_t), 1, fp);
+          fread(&len, sizeof(uint32_t), 1, fp);
+          si->assembly.resize(len);
+          fread(&si->assembly[0], 1, len, fp);
+
+          char buf[16];
+          snprintf(buf, sizeof(buf), "%x", si->addrn);
+          si->addr = buf;
+          parseAssembly(si);
+     }
+
+     lf->index.resize(lf->hdr.nentry);
+     fseek(fp, lf->hdr.indexoff, SEEK_SET);
+     if (lf->hdr.nentry != 0)
+          fread(&lf->index[0], sizeof(LoopIndexEntry), lf->hdr.nentry, fp);
+
+     return lf;
+}
+
+// return the position of an instance in the index, or -1
+int findLoopInstance(LoopFile *lf, uint32_t loopid, uint32_t instance)
+{
+     for (int i = 0, max = lf->index.size(); i < max; ++i) {
+          if (lf->index[i].loopid == loopid && lf->index[i].instance == instance)
+               return i;
+     }
+
+     return -1;
+}
+
+// read the n-th loop instance in the index into the instruction list L
+int readLoopInstance(LoopFile *lf, int n, list<Inst> *L)
+{
+     if (n < 0 || n >= (int)lf->index.size()) return 1;
+
+     LoopIndexEntry *e = &lf->index[n];
+     vector<InstRecord> recs(e->length);
+
+     fseek(lf->fp, e->offset, SEEK_SET);
+     if (e->length != 0 && fread(&recs[0], sizeof(InstRecord), e->length, lf->fp) != e->length)
+          return 1;
+
+     int num = 1;
+     for (vector<InstRecord>::iterator it = recs.begin(); it != recs.end(); ++it) {
+          if (it->sidx >= lf->insts.size()) return 1;
+
+          L->push_back(lf->insts[it->sidx]);
+          Inst *ins = &L->back();
+          ins->id = num++;
+          for (int j = 0; j < 8; ++j) {
+               ins->ctxreg[j] = it->ctxreg[j];
+          }
+          ins->memaddr = it->memaddr;
+     }
+
+     return 0;
+}
+
+void printLoopIndex(LoopFile *lf)
+{
+     printf("id\tloop\tstart\tinstance\tlength\tfingerprint\tconsts\tscore\n");
+     for (int i = 0, max = lf->index.size(); i < max; ++i) {
+          LoopIndexEntry *e = &lf->index[i];
+          printf("%d\t%u\t%x\t%u\t%u\t%08x\t%u\t%.2f\n", i + 1, e->loopid, e->startaddr,
+                 e->instance, e->length, e->fingerprint, e->consthits, e->feature[FEAT_SCORE]);
+     }
+}
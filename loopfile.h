@@ -0,0 +1,59 @@
+// Loop instance container
+//
+// All loop instances of a trace are stored in one file:
+//   LoopFileHeader | InstRecord ... | static instruction table | LoopIndexEntry ...
+// Every dynamic instruction is a fixed size binary record referring to an entry
+// of the static instruction table, so the disassembly of an instruction is
+// stored and parsed only once.
+
+#define LOOPFILE_MAGIC 0x504c4843    // "CHLP"
+#define LOOPFILE_VERSION 2
+
+struct LoopFileHeader {
+     uint32_t magic;
+     uint32_t version;
+     uint32_t ninst;            // number of static instructions
+     uint32_t nentry;           // number of loop instances
+     uint64_t instoff;          // offset of the static instruction table
+     uint64_t indexoff;         // offset of the index
+};
+
+// a dynamic instruction
+struct InstRecord {
+     uint32_t sidx;             // index in the static instruction table
+     uint32_t ctxreg[8];
+     uint32_t memaddr;
+};
+
+// a loop instance
+struct LoopIndexEntry {
+     uint32_t loopid;           // loop id in loopdetect output
+     uint32_t startaddr;        // start address of the loop
+     uint32_t instance;         // instance number in the loop
+     uint32_t length;           // number of InstRecord
+     uint64_t offset;           // file offset of the first InstRecord
+     uint32_t fingerprint;      // hash of the opcode sequence
+     uint32_t consthits;        // number of crypto constant hits
+     float feature[NFEATURE];   // feature vector of the loop, see loopfeature.h
+};
+
+struct LoopFile {
+     FILE *fp;
+     LoopFileHeader hdr;
+     vector<LoopIndexEntry> index;
+     vector<Inst> insts;        // static instructions, without dynamic values
+     map<pair<uint32_t, string>, uint32_t> instidx; // used when writing
+};
+
+uint32_t opcodeFingerprint(list<Inst>::iterator begin, list<Inst>::iterator end);
+
+LoopFile *createLoopFile(const char *filename);
+void writeLoopInstance(LoopFile *lf, uint32_t loopid, uint32_t instance,
+                       list<Inst>::iterator begin, list<Inst>::iterator end,
+                       uint32_t consthits, const float *feature);
+void closeLoopFile(LoopFile *lf);
+
+LoopFile *openLoopFile(const char *filename);
+int findLoopInstance(LoopFile *lf, uint32_t loopid, uint32_t instance);
+int readLoopInstance(LoopFile *lf, int n, list<Inst> *L);
+void printLoopIndex(LoopFile *lf);
@@ -5,17 +5,31 @@
 #include <string>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <set>
 #include <regex>
+#include <unistd.h>
 
 using namespace std;
 
 #include "core.h"
 #include "symengine.h"
 #include "varmap.h"
+#include "loopfeature.h"
+#include "loopfile.h"
+#include "loopcache.h"
+#include "slice.h"
+#include "diag.h"
 
-list<Inst> instlist1, instlist2;     // all instructions in the trace
+list<Inst> instlist1;                // all instructions in the reference trace
+
+// a target trace and its verdicts in the cache
+struct Target {
+     char *name;
+     list<Inst> insts;
+     LoopCacheEntry entry;
+};
 
 void printfirst3inst(list<Inst> *L)
 {
@@ -32,8 +46,44 @@ void printfirst3inst(list<Inst> *L)
      }
 }
 
+// registers known to the decoder and the bit offset of the sub-registers
+struct RegName {
+     const char *name;
+     int id;
+     int off;
+};
+
+RegName regnames[] = {
+     {"eax", EAX, 0}, {"ebx", EBX, 0}, {"ecx", ECX, 0}, {"edx", EDX, 0},
+     {"esi", ESI, 0}, {"edi", EDI, 0}, {"esp", ESP, 0}, {"ebp", EBP, 0},
+     {"ax", EAX, 0}, {"bx", EBX, 0}, {"cx", ECX, 0}, {"dx", EDX, 0},
+     {"si", ESI, 0}, {"di", EDI, 0}, {"sp", ESP, 0}, {"bp", EBP, 0},
+     {"al", EAX, 0}, {"bl", EBX, 0}, {"cl", ECX, 0}, {"dl", EDX, 0},
+     {"ah", EAX, 8}, {"bh", EBX, 8}, {"ch", ECX, 8}, {"dh", EDX, 8},
+     {"cs", CS, 0}, {"ds", DS, 0}, {"es", ES, 0}, {"fs", FS, 0}, {"gs", GS, 0}, {"ss", SS, 0},
+     {"st0", ST0, 0}, {"st1", ST1, 0}, {"st2", ST2, 0}, {"st3", ST3, 0}, {"st4", ST4, 0}, {"st5", ST5, 0}
+};
+
+RegName *findReg(string name)
+{
+     for (int i = 0; i < (int)(sizeof(regnames) / sizeof(regnames[0])); ++i) {
+          if (name == regnames[i].name) return &regnames[i];
+     }
+
+     return NULL;
+}
 
-Operand *createAddrOperand(string s)
+// resolve the register in field[i] of opr to its id
+void resolveReg(Operand *opr, int i)
+{
+     RegName *r = findReg(opr->field[i]);
+     if (r == NULL) return;
+
+     opr->regid[i] = r->id;
+     if (opr->ty == Operand::Reg) opr->regoff = r->off;
+}
+
+Operand *createAddrOperand(string s, uint32_t addr)
 {
      // regular expressions addresses
      regex addr1("0x[[:xdigit:]]+");
@@ -95,18 +145,20 @@ Operand *createAddrOperand(string s)
           opr->tag = 2;
           opr->field[0] = m[0];
      } else {
-          cout << "Unknown addr operands: " << s << endl;
+          diag(addr, "Unknown addr operands: " + s);
      }
+     resolveReg(opr, 0);
+     resolveReg(opr, 1);
 
      return opr;
 }
 
-Operand* createDataOperand(string s)
+Operand* createDataOperand(string s, uint32_t addr)
 {
      // Regular expressions for Immvalue and Registers
      regex immvalue("0x[[:xdigit:]]+");
      regex reg8("al|ah|bl|bh|cl|ch|dl|dh");
-     regex reg16("ax|bx|cx|dx|si|di|bp|cs|ds|es|fs|gs|ss");
+     regex reg16("ax|bx|cx|dx|si|di|sp|bp|cs|ds|es|fs|gs|ss");
      regex reg32("eax|ebx|ecx|edx|esi|edi|esp|ebp|st0|st1|st2|st3|st4|st5");
 
      Operand *opr = new Operand();
@@ -128,13 +180,14 @@ Operand* createDataOperand(string s)
           opr->bit = 32;
           opr->field[0] = m[0];
      } else {
-          cout << "Unknown data operands: " << s << endl;
+          diag(addr, "Unknown data operands: " + s);
      }
+     resolveReg(opr, 0);
 
      return opr;
 }
 
-Operand* createOperand(string s)
+Operand* createOperand(string s, uint32_t addr)
 {
      regex ptr("ptr \\[(.*)\\]");
      regex byteptr("byte ptr \\[(.*)\\]");
@@ -147,28 +200,29 @@ Operand* createOperand(string s)
 
      if (s.find("ptr") != string::npos) { // Operand is a mem access addr
           if (regex_search(s, m, byteptr)) {
-               opr = createAddrOperand(m[1]);
+               opr = createAddrOperand(m[1], addr);
                opr->bit = 8;
           } else if (regex_search(s, m, wordptr)) {
-               opr = createAddrOperand(m[1]);
+               opr = createAddrOperand(m[1], addr);
                opr->bit = 16;
           } else if (regex_search(s, m, dwordptr)) {
-               opr = createAddrOperand(m[1]);
+               opr = createAddrOperand(m[1], addr);
                opr->bit = 32;
           } else if (regex_search(s, m, segptr)) {
-               opr = createAddrOperand(m[2]);
+               opr = createAddrOperand(m[2], addr);
                opr->issegaddr = true;
                opr->bit = 32;
                opr->segreg = m[1];
           } else if (regex_search(s, m, ptr)) {
-               opr = createAddrOperand(m[1]);
+               opr = createAddrOperand(m[1], addr);
                opr->bit = 0;
           } else {
-               cout << "Unkown addr: " << s << endl;
+               diag(addr, "Unkown addr: " + s);
+               opr = new Operand();
           }
      } else {                   // Operand is data
           // cout << "data operand: " << s << endl;
-          opr = createDataOperand(s);
+          opr = createDataOperand(s, addr);
      }
 
      return opr;
@@ -179,7 +233,7 @@ void parseOperand(list<Inst>::iterator begin, list<Inst>::iterator end)
      // parse operands
      for (list<Inst>::iterator it = begin; it != end; ++it) {
           for (int i = 0; i < it->oprnum; ++i) {
-               it->oprd[i] = createOperand(it->oprs[i]);
+               it->oprd[i] = createOperand(it->oprs[i], it->addrn);
           }
      }
 
@@ -207,6 +261,7 @@ void parseTrace(ifstream *infile, list<Inst> *L)
 
           // get the disassemble string
           getline(strbuf, disasstr, ';');
+          ins->assembly = disasstr;
 
           istringstream disasbuf(disasstr);
           getline(disasbuf, ins->opcstr, ' ');
@@ -233,46 +288,385 @@ void parseTrace(ifstream *infile, list<Inst> *L)
      }
 }
 
-int main(int argc, char **argv) {
-     if (argc != 3) {
-          fprintf(stderr, "usage: %s <reference> <target>\n", argv[0]);
-          return 1;
+// Load a loop instance into L. The argument is either a text trace or a loop
+// container followed by an instance id, e.g. loops.dat:3 selects the third
+// instance and loops.dat:2.1 selects the first instance of loop 2.
+int loadTrace(string arg, list<Inst> *L)
+{
+     size_t colon = arg.rfind(':');
+     if (colon != string::npos) {
+          LoopFile *lf = openLoopFile(arg.substr(0, colon).c_str());
+          if (lf != NULL) {
+               string id = arg.substr(colon + 1);
+               size_t dot = id.find('.');
+               int n;
+               if (dot == string::npos)
+                    n = stoi(id) - 1;
+               else
+                    n = findLoopInstance(lf, stoul(id.substr(0, dot)), stoul(id.substr(dot + 1)));
+
+               int ret = readLoopInstance(lf, n, L);
+               fclose(lf->fp);
+               delete lf;
+               if (ret != 0) fprintf(stderr, "No loop instance %s!\n", arg.c_str());
+               return ret;
+          }
      }
-     ifstream infile1(argv[1]), infile2(argv[2]);
 
-     if (!infile1.is_open() || !infile2.is_open()) {
+     ifstream infile(arg);
+     if (!infile.is_open()) {
           fprintf(stderr, "Open file error!\n");
           return 1;
      }
+     parseTrace(&infile, L);
+     infile.close();
 
-     parseTrace(&infile1, &instlist1);
-     parseTrace(&infile2, &instlist2);
+     return 0;
+}
 
-     infile1.close();
-     infile2.close();
+// Declared inputs of a loop body: -i eax,ebx and -m 500000-500020
+struct InputDecl {
+     bool declared;
+     set<int> regs;
+     vector< pair<uint32_t, uint32_t> > ranges;
 
-     parseOperand(instlist1.begin(), instlist1.end());
-     parseOperand(instlist2.begin(), instlist2.end());
+     InputDecl() : declared(false) {}
+};
 
-     // Bit symbolic execution
-     SEEngine *se1 = new SEEngine();
-     se1->initAllRegSymol(instlist1.begin(), instlist1.end());
-     se1->symexec();
+int addInputRegs(InputDecl *d, string s)
+{
+     string reg;
+     istringstream strbuf(s);
+     while (getline(strbuf, reg, ',')) {
+          RegName *r = findReg(reg);
+          if (r == NULL || r->id > EBP || reg.size() != 3) {
+               fprintf(stderr, "%s is not a 32-bit register!\n", reg.c_str());
+               return 1;
+          }
+          d->regs.insert(r->id);
+     }
+     d->declared = true;
+     return 0;
+}
+
+int addInputRange(InputDecl *d, string s)
+{
+     size_t dash = s.find('-');
+     if (dash == string::npos) return 1;
+
+     d->ranges.push_back(make_pair(stoul(s.substr(0, dash), 0, 16), stoul(s.substr(dash + 1), 0, 16)));
+     d->declared = true;
+     return 0;
+}
+
+void initEngine(SEEngine *se, list<Inst> *L, InputDecl *d)
+{
+     if (d->declared)
+          se->initInputs(L->begin(), L->end(), &d->regs, &d->ranges);
+     else
+          se->initAllRegSymol(L->begin(), L->end());
+}
+
+// the number of instructions at the start of all targets that are the same
+int commonPrefix(list<Target> *targets)
+{
+     vector< list<Inst>::iterator > pos;
+     for (list<Target>::iterator it = targets->begin(); it != targets->end(); ++it) {
+          pos.push_back(it->insts.begin());
+     }
 
-     SEEngine *se2 = new SEEngine();
-     se2->initAllRegSymol(instlist2.begin(), instlist2.end());
-     se2->symexec();
+     for (int n = 0; ; ++n) {
+          list<Target>::iterator t = targets->begin();
+          for (size_t i = 0; i < pos.size(); ++i, ++t) {
+               if (pos[i] == t->insts.end()) return n;
+               Inst *a = &*pos[0], *b = &*pos[i];
+               if (a->addrn != b->addrn || a->assembly != b->assembly || a->memaddr != b->memaddr ||
+                   !equal(a->ctxreg, a->ctxreg + 8, b->ctxreg))
+                    return n;
+          }
+          for (size_t i = 0; i < pos.size(); ++i) {
+               ++pos[i];
+          }
+     }
+}
 
-     Value *v1 = se1->getValue("eax");
+// Map the outputs of a target executed in se2 to the reference formula v1,
+// return the number of mapped formulas, or -1 if the evaluators are timed
+int matchTarget(SEEngine *se1, Value *v1, SEEngine *se2, int benchruns, int *nformula)
+{
+     // formulas are simplified once more before variable mapping
+     se2->simplify();
 
      vector<Value*> tgt = se2->getAllOutput();
-     cout << tgt.size() << " fomulas found" << endl;
 
+     // the subformulas cut out of the target are matched on their own, the
+     // reference is not cut so that it is always matched as a whole
+     vector< pair<Value*, Value*> > cuts = se2->getCuts();
+     if (!cuts.empty()) {
+          cout << cuts.size() << " cut points" << '\n';
+          for (vector< pair<Value*, Value*> >::iterator it = cuts.begin(); it != cuts.end(); ++it) {
+               tgt.push_back(it->second);
+          }
+     }
+     cout << tgt.size() << " fomulas found" << '\n';
+     *nformula = tgt.size();
+
+     // compare the evaluators instead of mapping the variables
+     if (benchruns > 0) {
+          for (int i = 0, max = tgt.size(); i < max; ++i) {
+               cout << i+1 << ": ";
+               se2->benchFormula(tgt[i], benchruns);
+          }
+          return -1;
+     }
+
+     int matched = 0;
      for (int i = 0, max = tgt.size(); i < max; ++i) {
           cout << i+1 << ": ";
           Value *v2 = tgt[i];
-          varmapAndoutputCVC(se1, v1, se2, v2);
+          if (varmapAndoutputCVC(se1, v1, se2, v2) != 0) ++matched;
+     }
+     return matched;
+}
+
+void usage(char *prog)
+{
+     fprintf(stderr, "usage: %s [-C <cachedir>] [-N] [-s] [-L] [-P <segments>] [-G <nodes>] [-c <nodes>] [-d <depth>]\n", prog);
+     fprintf(stderr, "          [-v <logfile>] [-J <runs>] [-B <runs>] [-i <regs>] [-m <start-end>]\n");
+     fprintf(stderr, "          [-I <regs>] [-M <start-end>] <reference> <target> [<target>...]\n");
+     fprintf(stderr, "       %s -l <loopfile>\n", prog);
+}
+
+int main(int argc, char **argv) {
+     const char *cachedir = NULL;
+     const char *listfile = NULL;
+     bool buildsimp = true;
+     int benchruns = 0;
+     InputDecl refin, tgtin;
+     bool slicing = false;
+     int nseg = 1;
+     bool summarize = false;
+     uint32_t nodebudget = 0;
+     int depthbudget = 0;
+     string anaopts;            // options that change the verdict
+     int opt;
+
+     while ((opt = getopt(argc, argv, "C:l:NsLP:G:c:d:v:J:B:i:m:I:M:")) != -1) {
+          if (string("NscdimIM").find(opt) != string::npos)
+               anaopts += string(1, opt) + (optarg != NULL ? optarg : "") + " ";
+          switch (opt) {
+          case 'C':
+               cachedir = optarg;
+               break;
+          case 'l':
+               listfile = optarg;
+               break;
+          case 'N':
+               buildsimp = false;
+               break;
+          case 's':
+               slicing = true;
+               break;
+          case 'L':
+               summarize = true;
+               break;
+          case 'P':
+               nseg = atoi(optarg);
+               break;
+          case 'G':
+               gcthreshold = atoi(optarg);
+               break;
+          case 'c':
+               nodebudget = strtoul(optarg, NULL, 0);
+               break;
+          case 'd':
+               depthbudget = atoi(optarg);
+               break;
+          case 'v':
+               if (openDiagLog(optarg) != 0) {
+                    fprintf(stderr, "Open file error!\n");
+                    return 1;
+               }
+               break;
+          case 'J':
+               jitthreshold = atoi(optarg);
+               break;
+          case 'B':
+               benchruns = atoi(optarg);
+               break;
+          case 'i':
+          case 'I':
+               if (addInputRegs(opt == 'i' ? &refin : &tgtin, optarg) != 0) {
+                    usage(argv[0]);
+                    return 1;
+               }
+               break;
+          case 'm':
+          case 'M':
+               if (addInputRange(opt == 'm' ? &refin : &tgtin, optarg) != 0) {
+                    usage(argv[0]);
+                    return 1;
+               }
+               break;
+          default:
+               usage(argv[0]);
+               return 1;
+          }
+     }
+
+     if (listfile != NULL) {
+          LoopFile *lf = openLoopFile(listfile);
+          if (lf == NULL) {
+               fprintf(stderr, "Open file error!\n");
+               return 1;
+          }
+          printLoopIndex(lf);
+          return 0;
+     }
+     if (argc - optind < 2) {
+          usage(argv[0]);
+          return 1;
+     }
+
+     if (loadTrace(argv[optind], &instlist1) != 0)
+          return 1;
+     list<Target> targets;
+     for (int i = optind + 1; i < argc; ++i) {
+          targets.push_back(Target());
+          Target *t = &targets.back();
+          t->name = argv[i];
+          if (loadTrace(argv[i], &t->insts) != 0)
+               return 1;
+          t->entry.hash = loopBodyHash(t->insts.begin(), t->insts.end());
+          t->entry.startaddr = t->insts.empty() ? 0 : t->insts.front().addrn;
+          t->entry.length = t->insts.size();
+     }
+     // the results of several targets are printed under their names
+     bool named = targets.size() > 1;
+
+     // skip the targets whose verdict is in the cache, a verdict is kept for
+     // each reference and setting of the analysis options
+     uint64_t refhash = extendHash(loopBodyHash(instlist1.begin(), instlist1.end()), anaopts);
+     for (list<Target>::iterator it = targets.begin(); it != targets.end();) {
+          if (cachedir != NULL && loadCacheEntry(cachedir, it->entry.hash, &it->entry)) {
+               map<uint64_t, string>::iterator v = it->entry.verdict.find(refhash);
+               if (v != it->entry.verdict.end()) {
+                    if (named) cout << it->name << ":" << '\n';
+                    cout << "cached verdict: " << v->second << '\n';
+                    it = targets.erase(it);
+                    continue;
+               }
+          }
+          ++it;
+     }
+     if (targets.empty())
+          return 0;
+
+     parseOperand(instlist1.begin(), instlist1.end());
+     for (list<Target>::iterator it = targets.begin(); it != targets.end(); ++it) {
+          parseOperand(it->insts.begin(), it->insts.end());
+     }
+
+     // Bit symbolic execution of the reference
+     SEEngine *se1 = new SEEngine();
+     se1->setSimplify(buildsimp);
+     se1->setSummarize(summarize);
+     initEngine(se1, &instlist1, &refin);
+
+     // Only execute the instructions that the compared outputs depend on: eax
+     // of the reference, eax-edx and the written memory of the target
+     vector<bool> slice1;
+     int n1 = 0;
+     if (slicing) {
+          vector<DefUse> du1;
+          se1->buildDefUse(instlist1.begin(), instlist1.end(), &du1);
+          set<Loc> out1 = {EAX};
+          n1 = backwardSlice(&du1, &out1, &slice1);
+          se1->setSlice(&slice1);
+     }
+     se1->symexecParallel(nseg);
+     se1->simplify();
+     Value *v1 = se1->getValue(EAX);
+
+     if (benchruns > 0) {
+          cout << "reference: ";
+          se1->benchFormula(v1, benchruns);
+     }
+
+     // Targets with a common prefix, e.g. overlapping windows of a trace,
+     // execute the prefix once and each suffix from a snapshot after it.
+     // Slices, segments and loop summaries cover a whole target, so with
+     // them every target is executed on its own.
+     int npre = 0;
+     if (targets.size() > 1 && !slicing && nseg == 1 && !summarize)
+          npre = commonPrefix(&targets);
+
+     SEEngine *shared = NULL;
+     Snapshot *snap = NULL;
+     int preret = 0;
+     if (npre > 0) {
+          list<Inst> *L = &targets.front().insts;
+          shared = new SEEngine();
+          shared->setSimplify(buildsimp);
+          shared->setBudget(nodebudget, depthbudget);
+          initEngine(shared, L, &tgtin);
+          preret = shared->symexecRange(L->begin(), next(L->begin(), npre));
+          snap = shared->snapshot();
+          cout << "shared prefix: " << npre << " instructions" << '\n';
+     }
+
+     for (list<Target>::iterator it = targets.begin(); it != targets.end(); ++it) {
+          if (named) cout << it->name << ":" << '\n';
+
+          SEEngine *se2 = shared;
+          vector<bool> slice2;
+          if (shared != NULL) {
+               // a fatal instruction in the prefix stops every target
+               if (preret == 0)
+                    shared->symexecRange(next(it->insts.begin(), npre), it->insts.end());
+          } else {
+               se2 = new SEEngine();
+               se2->setSimplify(buildsimp);
+               se2->setSummarize(summarize);
+               se2->setBudget(nodebudget, depthbudget);
+               initEngine(se2, &it->insts, &tgtin);
+               if (slicing) {
+                    vector<DefUse> du2;
+                    se2->buildDefUse(it->insts.begin(), it->insts.end(), &du2);
+                    set<Loc> out2 = getMemDefs(&du2);
+                    out2.insert(EAX);
+                    out2.insert(EBX);
+                    out2.insert(ECX);
+                    out2.insert(EDX);
+                    int n2 = backwardSlice(&du2, &out2, &slice2);
+                    cout << "slice: " << n1 << " of " << slice1.size() << " reference instructions, "
+                         << n2 << " of " << du2.size() << " target instructions" << '\n';
+                    se2->setSlice(&slice2);
+               }
+               se2->symexecParallel(nseg);
+          }
+
+          int nformula;
+          int matched = matchTarget(se1, v1, se2, benchruns, &nformula);
+
+          if (shared != NULL)
+               shared->restore(snap);
+          else
+               delete se2;
+
+          if (cachedir != NULL && matched >= 0) {
+               it->entry.verdict[refhash] = to_string(matched) + " of " + to_string(nformula) +
+                    " formulas mapped";
+               storeCacheEntry(cachedir, &it->entry);
+          }
+     }
+
+     if (shared != NULL) {
+          shared->dropSnapshot(snap);
+          delete shared;
      }
+     delete se1;
+     printDiagSummary();
 
      return 0;
 }
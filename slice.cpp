@@ -0,0 +1,59 @@
+/*
+ * Backward dynamic slicer used by llse
+ *
+ * 1. SEEngine::buildDefUse indexes the locations of the instructions of a
+ *    loop body
+ * 2. Walk the body backward from the output locations and keep the
+ *    instructions that define a live location
+ *
+ */
+
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <set>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#include "core.h"
+#include "slice.h"
+
+// all memory locations written in the body
+set<Loc> getMemDefs(vector<DefUse> *du)
+{
+     set<Loc> mem;
+     for (vector<DefUse>::iterator it = du->begin(); it != du->end(); ++it) {
+          for (vector<Loc>::iterator i = it->def.begin(); i != it->def.end(); ++i) {
+               if (LOC_ISMEM(*i)) mem.insert(*i);
+          }
+     }
+
+     return mem;
+}
+
+// Select the instructions that contribute to the locations in out at the end
+// of the body, return the number of selected instructions
+int backwardSlice(vector<DefUse> *du, set<Loc> *out, vector<bool> *inslice)
+{
+     set<Loc> live = *out;
+     int n = 0;
+
+     inslice->assign(du->size(), false);
+     for (int i = du->size() - 1; i >= 0; --i) {
+          DefUse *d = &(*du)[i];
+          bool needed = d->stop;
+          for (vector<Loc>::iterator it = d->def.begin(); it != d->def.end(); ++it) {
+               if (live.erase(*it) != 0) needed = true;
+          }
+          if (!needed) continue;
+
+          (*inslice)[i] = true;
+          ++n;
+          live.insert(d->use.begin(), d->use.end());
+     }
+
+     return n;
+}
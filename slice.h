@@ -0,0 +1,22 @@
+// Backward dynamic slicing of a trace before symbolic execution
+//
+// Every instruction gets the locations it defines and uses in the translation
+// that SEEngine::execRange runs: registers by id and memory by the address
+// recorded in the trace. A write to a sub-register also uses the register.
+// The slice of a set of output locations is the set of instructions their
+// values depend on.
+
+// a register id or a memory address
+typedef uint64_t Loc;
+
+#define LOC_MEM(addr) ((1ull << 32) | (addr))
+#define LOC_ISMEM(loc) (((loc) >> 32) != 0)
+
+struct DefUse {
+     vector<Loc> def;
+     vector<Loc> use;
+     bool stop;                 // the execution stops at the instruction
+};
+
+set<Loc> getMemDefs(vector<DefUse> *du);
+int backwardSlice(vector<DefUse> *du, set<Loc> *out, vector<bool> *inslice);
@@ -13,48 +13,95 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <queue>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <time.h>
+#ifdef __x86_64__
+#include <sys/mman.h>
+#endif
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 #include "core.h"
 #include "symengine.h"
 #include "varmap.h"
+#include "slice.h"
+#include "diag.h"
 
-enum ValueTy {SYMBOL, CONCRETE};
-enum OperTy {ADD, MOV, SHL, XOR, SHR};
+enum ValueTy {SYMBOL, CONCRETE, FREE};  // FREE: released by collect
+
+// Operators of operation nodes. Other mnemonics are appended to opnames when
+// they are first built; they are kept in formulas but not interpreted.
+enum OperTy {ADD, SUB, IMUL, XOR, AND, OR, SHL, SHR, NEG, INC};
+#define NINTERP (INC + 1)       // operators below NINTERP are interpreted
+
+vector<string> opnames = {"add", "sub", "imul", "xor", "and", "or", "shl", "shr", "neg", "inc"};
+unordered_map<string, int> opids;
+mutex opmutex;                  // engines may run on several threads
+
+int getOpTy(string s)
+{
+     lock_guard<mutex> lock(opmutex);
+     if (opids.empty()) {
+          for (int i = 0, max = opnames.size(); i < max; ++i) {
+               opids[opnames[i]] = i;
+          }
+     }
+
+     unordered_map<string, int>::iterator it = opids.find(s);
+     if (it != opids.end())
+          return it->second;
+
+     opnames.push_back(s);
+     opids[s] = opnames.size() - 1;
+     return opnames.size() - 1;
+}
 
 
 // A symbolic or concrete value in a formula
 struct Value {
-     ValueTy valty;             // value type: SYMBOL or CONCRETE
      Operation *opr;
-     string conval;             // concrete value
-     int id;                 // a unique id for each value
-     static int idseed;
+     int id;                    // a unique id for each value
+     uint8_t valty;             // value type: SYMBOL or CONCRETE
+     uint8_t mark;              // epoch of the last collection that reached it
+     uint16_t depth;            // height of the formula, saturated
+     uint32_t conval;           // concrete value
+     int symno;                 // index of a symbol in its engine
+     uint32_t size;             // node count of the formula as a tree, saturated
+     static atomic<int> idseed;
 
      Value(ValueTy vty);
-     Value(ValueTy vty, string con); // constructor for concrete value
+     Value(ValueTy vty, uint32_t con); // constructor for concrete value
      Value(ValueTy vty, Operation *oper);
      bool isSymbol();
 };
 
-int Value::idseed = 0;
+atomic<int> Value::idseed(0);
 
-Value::Value(ValueTy vty) : opr(NULL)
+Value::Value(ValueTy vty) : opr(NULL), mark(0), depth(0), conval(0), symno(-1), size(1)
 {
      id = ++idseed;
      valty = vty;
 }
 
-Value::Value(ValueTy vty, string con) : opr(NULL)
+Value::Value(ValueTy vty, uint32_t con) : opr(NULL), mark(0), depth(0), symno(-1), size(1)
 {
      id = ++idseed;
      valty = vty;
      conval = con;
 }
 
-Value::Value(ValueTy vty, Operation *oper) {
+Value::Value(ValueTy vty, Operation *oper) : mark(0), depth(0), conval(0), symno(-1), size(1)
+{
      id = ++idseed;
      valty = vty;
      opr = oper;
@@ -67,25 +114,41 @@ bool Value::isSymbol() {
           return false;
 }
 
+// value of the register operand op before the instruction
+uint32_t Inst::getRegVal(Operand *op)
+{
+     int id = op->regid[0];
+     if (id < 0 || id > EBP) {
+          diag(addrn, "getRegVal: " + op->field[0] + " is not in the trace context!");
+          return 0;
+     }
+     if (op->bit >= 32) return ctxreg[id];
+
+     return (ctxreg[id] >> op->regoff) & ((1u << op->bit) - 1);
+}
+
 string getValueName(Value *v)
 {
      if (v->valty == SYMBOL)
           return "sym" + to_string(v->id);
-     else
-          return v->conval;
+     else {
+          char buf[16];
+          snprintf(buf, sizeof(buf), "0x%x", v->conval);
+          return buf;
+     }
 }
 
 // An operation taking several values to calculate a result value
 struct Operation {
-     string opty;
+     uint16_t opty;             // index in opnames
      Value *val[3];
 
-     Operation(string opt, Value *v1);
-     Operation(string opt, Value *v1, Value *v2);
-     Operation(string opt, Value *v1, Value *v2, Value *v3);
+     Operation(int opt, Value *v1);
+     Operation(int opt, Value *v1, Value *v2);
+     Operation(int opt, Value *v1, Value *v2, Value *v3);
 };
 
-Operation::Operation(string opt, Value *v1)
+Operation::Operation(int opt, Value *v1)
 {
      opty = opt;
      val[0] = v1;
@@ -93,7 +156,7 @@ Operation::Operation(string opt, Value *v1)
      val[2] = NULL;
 }
 
-Operation::Operation(string opt, Value *v1, Value *v2)
+Operation::Operation(int opt, Value *v1, Value *v2)
 {
      opty = opt;
      val[0] = v1;
@@ -101,7 +164,7 @@ Operation::Operation(string opt, Value *v1, Value *v2)
      val[2] = NULL;
 }
 
-Operation::Operation(string opt, Value *v1, Value *v2, Value *v3)
+Operation::Operation(int opt, Value *v1, Value *v2, Value *v3)
 {
      opty = opt;
      val[0] = v1;
@@ -109,546 +172,2210 @@ Operation::Operation(string opt, Value *v1, Value *v2, Value *v3)
      val[2] = v3;
 }
 
-Value *buildop1(string opty, Value *v1)
+// Bump allocator for nodes of one type. Nodes are constructed in place in
+// large chunks and are all destroyed together with the pool. Nodes released
+// by the collector are reused first, they must not need a destructor.
+template <class T>
+class NodePool {
+private:
+     static const size_t CHUNK = 4096;
+     vector<T*> chunks;
+     size_t used;               // nodes constructed in the last chunk
+     vector<T*> freelist;
+
+public:
+     NodePool() : used(CHUNK) {}
+     ~NodePool() {
+          for (size_t i = 0, max = chunks.size(); i < max; ++i) {
+               size_t n = (i + 1 == max) ? used : CHUNK;
+               for (size_t j = 0; j < n; ++j) {
+                    chunks[i][j].~T();
+               }
+               ::operator delete(chunks[i]);
+          }
+     }
+     void *alloc() {
+          if (!freelist.empty()) {
+               T *p = freelist.back();
+               freelist.pop_back();
+               return p;
+          }
+          if (used == CHUNK) {
+               chunks.push_back((T*)::operator new(CHUNK * sizeof(T)));
+               used = 0;
+          }
+          return &chunks.back()[used++];
+     }
+     void release(T *p) { freelist.push_back(p); }
+     size_t size() { return chunks.empty() ? 0 : (chunks.size() - 1) * CHUNK + used; }
+     size_t live() { return size() - freelist.size(); }
+     T *at(size_t i) { return &chunks[i / CHUNK][i % CHUNK]; }
+};
+
+struct NodeArena {
+     NodePool<Value> values;
+     NodePool<Operation> opers;
+};
+
+// Operation codes of a tape: interpreted operators keep their OperTy value
+enum TapeOp {TAPE_CONST = 0x100, TAPE_INPUT, TAPE_UNKNOWN};
+
+// One step of a tape. Its result goes to the slot with the same index.
+struct TapeInst {
+     uint16_t op;
+     uint32_t a, b;             // operand slots, the input index or the constant
+};
+
+// A formula compiled into a topologically ordered list of operations
+struct Tape {
+     vector<TapeInst> code;
+     vector<Value*> inputs;     // input symbols, indexed by TAPE_INPUT
+     vector<uint32_t> regs;     // slots, reused by every run
+     uint32_t nrun;             // rows evaluated, hot tapes are compiled to native code
+
+     // native code of the tape, NULL if it is not compiled
+     uint32_t (*jit)(const uint32_t *in, uint32_t *regs);
+     void *jitmem;
+     size_t jitsize;
+
+     Tape() : nrun(0), jit(NULL), jitmem(NULL), jitsize(0) {}
+     ~Tape();
+};
+
+// number of conexec runs of a formula before it is compiled to native code,
+// negative to always use the interpreter
+int jitthreshold = 64;
+
+// live nodes of an engine which start a collection, 0 turns collection off
+int gcthreshold = 1 << 20;
+
+// compute an interpreted operator on concrete operands
+uint32_t evalop(int opty, uint32_t op0, uint32_t op1)
+{
+     switch (opty) {
+     case ADD: return op0 + op1;
+     case SUB: return op0 - op1;
+     case IMUL: return op0 * op1;
+     case XOR: return op0 ^ op1;
+     case AND: return op0 & op1;
+     case OR: return op0 | op1;
+     case SHL: return op0 << (op1 & 0x1f);
+     case SHR: return op0 >> (op1 & 0x1f);
+     case NEG: return ~op0 + 1;
+     case INC: return op0 + 1;
+     default: return 0;
+     }
+}
+
+bool isconst(Value *v)
 {
-     Operation *oper = new Operation(opty, v1);
+     return v->opr == NULL && v->valty == CONCRETE;
+}
+
+// operation with a constant as the second operand, e.g. (x + 0x4)
+bool isconstop(Value *v, int opty)
+{
+     return v->opr != NULL && v->opr->opty == opty && v->opr->val[1] != NULL &&
+          isconst(v->opr->val[1]);
+}
+
+// Build operation nodes through the hash-consing table, so that an operation
+// on the same operand nodes is created only once and shared. Operations on
+// concrete values only are folded into a concrete value right away.
+Value *SEEngine::buildop1(int opty, Value *v1)
+{
+     if (opty < NINTERP && v1->opr == NULL && !v1->isSymbol())
+          return buildcon(evalop(opty, v1->conval, 0));
+     if (simp) {
+          Value *v = simplifyop(opty, v1, NULL);
+          if (v != NULL) return v;
+     }
+
+     OpKey key = {opty, {v1, NULL, NULL}};
+     unordered_map<OpKey, Value*, OpKeyHash>::iterator it = optable.find(key);
+     if (it != optable.end())
+          return it->second;
+
+     Operation *oper = new (arena->opers.alloc()) Operation(opty, v1);
      Value *result;
 
      if (v1->isSymbol())
-          result = new Value(SYMBOL, oper);
+          result = new (arena->values.alloc()) Value(SYMBOL, oper);
      else
-          result = new Value(CONCRETE, oper);
+          result = new (arena->values.alloc()) Value(CONCRETE, oper);
 
+     result = cutpoint(result);
+     optable.insert(make_pair(key, result));
      return result;
 }
 
-Value *buildop2(string opty, Value *v1, Value *v2)
+Value *SEEngine::buildop2(int opty, Value *v1, Value *v2)
 {
-     Operation *oper = new Operation(opty, v1, v2);
+     if (opty < NINTERP && v1->opr == NULL && !v1->isSymbol() &&
+         v2->opr == NULL && !v2->isSymbol())
+          return buildcon(evalop(opty, v1->conval, v2->conval));
+     if (simp) {
+          // constants go to the right of commutative operators
+          if ((opty == ADD || opty == IMUL || opty == XOR || opty == AND || opty == OR) &&
+              isconst(v1) && !isconst(v2))
+               swap(v1, v2);
+          Value *v = simplifyop(opty, v1, v2);
+          if (v != NULL) return v;
+     }
+
+     OpKey key = {opty, {v1, v2, NULL}};
+     unordered_map<OpKey, Value*, OpKeyHash>::iterator it = optable.find(key);
+     if (it != optable.end())
+          return it->second;
+
+     Operation *oper = new (arena->opers.alloc()) Operation(opty, v1, v2);
      Value *result;
      if (v1->isSymbol() || v2->isSymbol())
-          result = new Value(SYMBOL, oper);
+          result = new (arena->values.alloc()) Value(SYMBOL, oper);
      else
-          result = new Value(CONCRETE, oper);
+          result = new (arena->values.alloc()) Value(CONCRETE, oper);
 
+     result = cutpoint(result);
+     optable.insert(make_pair(key, result));
      return result;
 }
 
-Value *buildop3(string opty, Value *v1, Value *v2, Value *v3)
+Value *SEEngine::buildop3(int opty, Value *v1, Value *v2, Value *v3)
 {
-     Operation *oper = new Operation(opty, v1, v2, v3);
+     OpKey key = {opty, {v1, v2, v3}};
+     unordered_map<OpKey, Value*, OpKeyHash>::iterator it = optable.find(key);
+     if (it != optable.end())
+          return it->second;
+
+     Operation *oper = new (arena->opers.alloc()) Operation(opty, v1, v2, v3);
      Value *result;
 
      if (v1->isSymbol() || v2->isSymbol() || v3->isSymbol())
-          result = new Value(SYMBOL, oper);
+          result = new (arena->values.alloc()) Value(SYMBOL, oper);
      else
-          result = new Value(CONCRETE, oper);
+          result = new (arena->values.alloc()) Value(CONCRETE, oper);
 
+     result = cutpoint(result);
+     optable.insert(make_pair(key, result));
      return result;
 }
 
+// A new node over the size or depth budget is replaced by a fresh cut-point
+// symbol. The cut is recorded, and the hash-consing table maps the operation
+// to the symbol, so the same subformula is always cut into the same symbol.
+Value *SEEngine::cutpoint(Value *v)
+{
+     Operation *op = v->opr;
+     for (int i = 0; i < 3 && op->val[i] != NULL; ++i) {
+          v->size = min((uint64_t)UINT32_MAX, (uint64_t)v->size + op->val[i]->size);
+          v->depth = max((int)v->depth, min(UINT16_MAX, op->val[i]->depth + 1));
+     }
+
+     if ((nodebudget == 0 || v->size <= nodebudget) && (depthbudget == 0 || v->depth <= depthbudget))
+          return v;
 
-// class SEEngine Implementation
-void SEEngine::init(Value *v1, Value *v2, Value *v3, Value *v4,
-                    Value *v5, Value *v6, Value *v7, Value *v8,
-                    list<Inst>::iterator it1,
-                    list<Inst>::iterator it2)
+     Value *c = buildsym();
+     cuts.push_back(make_pair(c, v));
+     return c;
+}
+
+// concrete values are shared as well
+Value *SEEngine::buildcon(uint32_t con)
 {
-     ctx["eax"] = v1;
-     ctx["ebx"] = v2;
-     ctx["ecx"] = v3;
-     ctx["edx"] = v4;
-     ctx["esi"] = v5;
-     ctx["edi"] = v6;
-     ctx["esp"] = v7;
-     ctx["ebp"] = v8;
+     unordered_map<uint32_t, Value*>::iterator it = contable.find(con);
+     if (it != contable.end())
+          return it->second;
 
-     this->start = it1;
-     this->end = it2;
+     Value *result = new (arena->values.alloc()) Value(CONCRETE, con);
+     contable.insert(make_pair(con, result));
+     return result;
 }
 
-void SEEngine::init(list<Inst>::iterator it1,
-                    list<Inst>::iterator it2)
+// a fresh symbol
+Value *SEEngine::buildsym()
 {
-     this->start = it1;
-     this->end = it2;
+     Value *v = new (arena->values.alloc()) Value(SYMBOL);
+     v->symno = syms.size();
+     syms.push_back(v);
+     return v;
 }
 
-void SEEngine::initAllRegSymol(list<Inst>::iterator it1,
-                               list<Inst>::iterator it2)
+// Rewrite (opty v1 v2) into a simpler equivalent value, or return NULL if no
+// rule applies. Constants of commutative operators are already on the right.
+// The result is built with buildop, so rules are applied again on it. v2 is
+// NULL for unary operators.
+Value *SEEngine::simplifyop(int opty, Value *v1, Value *v2)
 {
-     ctx["eax"] = new Value(SYMBOL);
-     ctx["ebx"] = new Value(SYMBOL);
-     ctx["ecx"] = new Value(SYMBOL);
-     ctx["edx"] = new Value(SYMBOL);
-     ctx["esi"] = new Value(SYMBOL);
-     ctx["edi"] = new Value(SYMBOL);
-     ctx["esp"] = new Value(SYMBOL);
-     ctx["ebp"] = new Value(SYMBOL);
+     if (opty == NEG) {
+          if (v1->opr != NULL && v1->opr->opty == NEG)
+               return v1->opr->val[0]; // neg neg x = x
+          return NULL;
+     }
+     if (v2 == NULL || opty >= NINTERP) return NULL;
 
-     this->start = it1;
-     this->end = it2;
-}
+     if (v1 == v2) {
+          if (opty == XOR || opty == SUB) return buildcon(0);
+          if (opty == AND || opty == OR) return v1;
+     }
+     if (!isconst(v2)) return NULL;
+
+     uint32_t c = v2->conval;
+     Value *x = v1->opr != NULL ? v1->opr->val[0] : NULL;
+     uint32_t c1 = (v1->opr != NULL && v1->opr->val[1] != NULL) ? v1->opr->val[1]->conval : 0;
+
+     switch (opty) {
+     case SUB:
+          return buildop2(ADD, v1, buildcon(~c + 1)); // x - c = x + (-c)
+     case ADD:
+          if (c == 0) return v1;
+          if (isconstop(v1, ADD)) return buildop2(ADD, x, buildcon(c1 + c));
+          break;
+     case XOR:
+          if (c == 0) return v1;
+          if (isconstop(v1, XOR)) return buildop2(XOR, x, buildcon(c1 ^ c));
+          break;
+     case AND:
+          if (c == 0) return v2;
+          if (c == 0xffffffff) return v1;
+          if (isconstop(v1, AND)) return buildop2(AND, x, buildcon(c1 & c));
+          break;
+     case OR:
+          if (c == 0) return v1;
+          if (c == 0xffffffff) return v2;
+          if (isconstop(v1, OR)) return buildop2(OR, x, buildcon(c1 | c));
+          break;
+     case IMUL:
+          if (c == 0) return v2;
+          if (c == 1) return v1;
+          if (isconstop(v1, IMUL)) return buildop2(IMUL, x, buildcon(c1 * c));
+          break;
+     case SHL:
+     case SHR:
+          c &= 0x1f;
+          if (c == 0) return v1;
+          if (isconstop(v1, opty)) { // (x << c1) << c = x << (c1 + c)
+               c1 &= 0x1f;
+               if (c1 + c >= 32) return buildcon(0);
+               return buildop2(opty, x, buildcon(c1 + c));
+          }
+          // (x << c) >> c and (x >> c) << c only clear bits
+          if (opty == SHR && isconstop(v1, SHL) && (c1 & 0x1f) == c)
+               return buildop2(AND, x, buildcon(0xffffffff >> c));
+          if (opty == SHL && isconstop(v1, SHR) && (c1 & 0x1f) == c)
+               return buildop2(AND, x, buildcon(0xffffffff << c));
+          break;
+     }
 
-// instructions which have no effect in symbolic execution
-set<string> noeffectinst = {"test","jmp","jz","jbe","jo","jno","js","jns","je","jne",
-                            "jnz","jb","jnae","jc","jnb","jae",
-                            "jnc","jna","ja","jnbe","jl",
-                            "jnge","jge","jnl","jle","jng","jg",
-                            "jnle","jp","jpe","jnp","jpo","jcxz",
-                            "jecxz"};
+     return NULL;
+}
 
-int SEEngine::symexec()
+// rebuild v bottom up, so that all rules are applied to its operations
+Value *SEEngine::rewrite(Value *v, unordered_map<Value*, Value*> *done)
 {
-     for (list<Inst>::iterator it = start; it != end; ++it) {
-          // cout << hex << it->addrn << ": ";
-          // cout << it->opcstr << '\n';
+     if (v == NULL || v->opr == NULL) return v;
 
-          // skip no effect instructions
-          if (noeffectinst.find(it->opcstr) != noeffectinst.end()) continue;
+     unordered_map<Value*, Value*>::iterator it = done->find(v);
+     if (it != done->end()) return it->second;
 
-          switch (it->oprnum) {
-          case 0:
-               break;
-          case 1:
-          {
-               Operand *op0 = it->oprd[0];
-               Value *v0, *res;
-               if (it->opcstr == "push") {
-                    if (op0->ty == Operand::ImmValue) {
-                         v0 = new Value(CONCRETE, op0->field[0]);
-                         mem[it->memaddr] = v0;
-                    } else if (op0->ty == Operand::Reg) {
-                         mem[it->memaddr] = ctx[op0->field[0]];
-                    } else if (op0->ty == Operand::Mem) {
-                         // The memaddr in the trace is the read address
-                         // We need to compute the write address
-                         uint32_t espval = it->ctxreg[6];
-                         if (memfind(it->memaddr)) {
-                              v0 = mem[it->memaddr];
-                         } else {
-                              v0 = new Value(SYMBOL);
-                              mem[it->memaddr] = v0;
-                         }
-                         mem[espval-4] = v0;
-                    } else {
-                         cout << "push error: the operand is not Imm, Reg or Mem!" << endl;
-                         return 1;
-                    }
-               } else if (it->opcstr == "pop") {
-                    if (op0->ty == Operand::Reg) {
-                          ctx[op0->field[0]] = mem[it->memaddr];
-                    } else {
-                         cout << "pop error: the operand is not Reg!" << endl;
-                         return 1;
-                    }
-               } else if (it->opcstr == "neg") {
-                    if (op0->ty == Operand::Reg) {
-                         v0 = ctx[op0->field[0]];
-                         res = buildop1(it->opcstr, v0);
-                         ctx[op0->field[0]] = res;
-                    } else if (op0->ty == Operand::Mem) {
-                         cout << "neg error: the operand is not Reg!" << endl;
-                         return 1;
-                    }
-               } else {
-                    cout << "instruction " << it->opcstr << " is not handled!" << endl;
-               }
-               break;
-          }
-          case 2:
-          {
-               Operand *op0 = it->oprd[0];
-               Operand *op1 = it->oprd[1];
-               Value *v0, *v1, *res;
-
-               if (it->opcstr == "mov") { // handle mov instruction
-                    if (op0->ty == Operand::Reg) {
-                         if (op1->ty == Operand::ImmValue) { // mov reg, 0x1111
-                              v1 = new Value(CONCRETE, op1->field[0]);
-                              ctx[op0->field[0]] = v1;
-                         } else if (op1->ty == Operand::Reg) { // mov reg, reg
-                              ctx[op0->field[0]] = ctx[op1->field[0]];
-                         } else if (op1->ty == Operand::Mem) { // mov reg, dword ptr [ebp+0x1]
-                              /* 1. Get mem address
-                                 2. check whether the mem address has been accessed
-                                 3. if not, create a new value
-                                 4. else load the value in that memory
-                               */
-                              if (memfind(it->memaddr)) {
-                                   v1 = mem[it->memaddr];
-                              } else {
-                                   v1 = new Value(SYMBOL);
-                                   mem[it->memaddr] = v1;
-                              }
-                              ctx[op0->field[0]] = v1;
-                         } else {
-                              cout << "op1 is not ImmValue, Reg or Mem" << endl;
-                              return 1;
-                         }
-                    } else if (op0->ty == Operand::Mem) {
-                         if (op1->ty == Operand::ImmValue) { // mov dword ptr [ebp+0x1], 0x1111
-                              mem[it->memaddr] = new Value(CONCRETE, op1->field[0]);
-                         } else if (op1->ty == Operand::Reg) { // mov dword ptr [ebp+0x1], reg
-                              mem[it->memaddr] = ctx[op1->field[0]];
-                         }
-                    } else {
-                         cout << "Error: The first operand in MOV is not Reg or Mem!" << endl;
-                    }
-               } else if (it->opcstr == "lea") { // handle lea instruction
-                    /* lea reg, ptr [edx+eax*1]
-                       interpret lea instruction based on different address type
-                       1. op0 must be reg
-                       2. op1 must be addr
-                     */
-                    if (op0->ty != Operand::Reg || op1->ty != Operand::Mem) {
-                         cout << "lea format error!" << endl;
-                    }
-                    switch (op1->tag) {
-                    case 5:
-                    {
-                         Value *f0, *f1, *f2; // corresponding field[0-2] in operand
-                         f0 = ctx[op1->field[0]];
-                         f1 = ctx[op1->field[1]];
-                         f2 = new Value(CONCRETE, op1->field[2]);
-                         res = buildop2("imul", f1, f2);
-                         res = buildop2("add",f0, res);
-                         ctx[op0->field[0]] = res;
-                         break;
-                    }
-                    default:
-                         cout << "Other tags in addr is not ready for lea!" << endl;
-                         break;
-                    }
-               } else if (it->opcstr == "xchg") {
-                    if (op1->ty == Operand::Reg) {
-                         v1 = ctx[op1->field[0]];
-                         if (op0->ty == Operand::Reg) {
-                              v0 = ctx[op0->field[0]];
-                              ctx[op1->field[0]] = v0; // xchg reg, reg
-                              ctx[op0->field[0]] = v1;
-                         } else if (op0->ty == Operand::Mem) {
-                              if (memfind(it->memaddr)) {
-                                   v0 = mem[it->memaddr];
-                              } else {
-                                   v0 = new Value(SYMBOL);
-                                   mem[it->memaddr] = v0;
-                              }
-                              ctx[op1->field[0]] = v0; // xchg mem, reg
-                              mem[it->memaddr] = v1;
-                         } else {
-                              cout << "xchg error: 1" << endl;
-                         }
-                    } else if (op1->ty == Operand::Mem) {
-                         if (memfind(it->memaddr)) {
-                              v1 = mem[it->memaddr];
-                         } else {
-                              v1 = new Value(SYMBOL);
-                              mem[it->memaddr] = v1;
-                         }
-                         if (op0->ty == Operand::Reg) {
-                              v0 = ctx[op0->field[0]];
-                              ctx[op0->field[0]] = v1; // xchg reg, mem
-                              mem[it->memaddr] = v0;
-                         } else {
-                              cout << "xchg error 3" << endl;
-                         }
-                    } else {
-                         cout << "xchg error: 2" << endl;
-                    }
-               } else { // handle other instructions
-                    if (op1->ty == Operand::ImmValue) {
-                         v1 = new Value(CONCRETE, op1->field[0]);
-                    } else if (op1->ty == Operand::Reg) {
-                         v1 = ctx[op1->field[0]];
-                    } else if (op1->ty == Operand::Mem) {
-                         if (memfind(it->memaddr)) {
-                              v1 = mem[it->memaddr];
-                         } else {
-                              v1 = new Value(SYMBOL);
-                              mem[it->memaddr] = v1;
-                         }
-                    } else {
-                         cout << "other instructions: op1 is not ImmValue, Reg, or Mem!" << endl;
-                         return 1;
-                    }
+     Operation *op = v->opr;
+     Value *v1 = rewrite(op->val[0], done);
+     Value *v2 = rewrite(op->val[1], done);
+     Value *v3 = rewrite(op->val[2], done);
+     Value *res;
+     if (v3 != NULL)
+          res = buildop3(op->opty, v1, v2, v3);
+     else if (v2 != NULL)
+          res = buildop2(op->opty, v1, v2);
+     else
+          res = buildop1(op->opty, v1);
 
-                    if (op0->ty == Operand::Reg) { // dest op is reg
-                         v0 = ctx[op0->field[0]];
-                         res = buildop2(it->opcstr, v0, v1);
-                         ctx[op0->field[0]] = res;
-                    } else if (op0->ty == Operand::Mem) { // dest op is mem
-                         if (memfind(it->memaddr)) {
-                              v0 = mem[it->memaddr];
-                         } else {
-                              v0 = new Value(SYMBOL);
-                              mem[it->memaddr] = v0;
-                         }
-                         res = buildop2(it->opcstr, v0, v1);
-                         mem[it->memaddr] = res;
-                    } else {
-                         cout << "other instructions: op2 is not ImmValue, Reg, or Mem!" << endl;
-                         return 1;
-                    }
+     done->insert(make_pair(v, res));
+     return res;
+}
 
-               }
+// simplify all formulas in registers and memory
+void SEEngine::simplify()
+{
+     bool oldsimp = simp;
+     unordered_map<Value*, Value*> done;
 
-               break;
-          }
-          case 3:
-          {
-               Operand *op0 = it->oprd[0];
-               Operand *op1 = it->oprd[1];
-               Operand *op2 = it->oprd[2];
-               Value *v1, *v2, *res;
-
-               // three operands instructions are reduced to two operands
-               if (it->opcstr == "imul" && op0->ty == Operand::Reg &&
-                   op1->ty == Operand::Reg && op2->ty == Operand::ImmValue) { // imul reg, reg, imm
-                    v1 = ctx[op1->field[0]];
-                    v2 = new Value(CONCRETE, op2->field[0]);
-                    res = buildop2(it->opcstr, v1, v2);
-                    ctx[op0->field[0]] = res;
-               } else {
-                    cout << "three operands instructions other than imul are not handled!" << endl;
-               }
-               break;
-          }
-          default:
-               cout << "all instructions: number of operands is larger than 4!" << endl;
-               break;
-          }
+     simp = true;
+     for (int i = 0; i < NREG; ++i) {
+          ctx[i] = rewrite(ctx[i], &done);
      }
-     return 0;
+     vector< pair<uint32_t, Value*> > slots;
+     mem.getSlots(&slots);
+     for (vector< pair<uint32_t, Value*> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+          mem[it->first] = rewrite(it->second, &done);
+     }
+     simp = oldsimp;
 }
 
-void traverse(Value *v)
-{
-     if (v == NULL) return;
 
-     Operation *op = v->opr;
-     if (op == NULL) {
-          if (v->valty == CONCRETE)
-               cout << v->conval;
-          else
-               cout << "sym" << v->id;
-     } else {
-          cout << "(" << op->opty << " ";
-          traverse(op->val[0]);
-          cout << " ";
-          traverse(op->val[1]);
-          cout << ")";
+ShadowMem::ShadowMem() : sorted(true)
+{
+     for (int i = 0; i < 1 << (32 - MEMTBL_BITS - MEMPAGE_BITS); ++i) {
+          dir[i] = NULL;
      }
 }
 
-void SEEngine::outputFormula(string reg)
+ShadowMem::~ShadowMem()
 {
-     Value *v = ctx[reg];
-     cout << "sym" << v->id << "=" << endl;
-     traverse(v);
-     cout << endl;
+     release();
 }
 
-vector<Value*> SEEngine::getAllOutput()
+// drop all pages, a page is freed when no other memory shares it
+void ShadowMem::release()
 {
-     vector<Value*> outputs;
-     Value *v;
+     for (int i = 0; i < 1 << (32 - MEMTBL_BITS - MEMPAGE_BITS); ++i) {
+          if (dir[i] == NULL) continue;
+          for (int j = 0; j < MEMTBL_SIZE; ++j) {
+               if (dir[i][j] != NULL && --dir[i][j]->ref == 0)
+                    delete dir[i][j];
+          }
+          delete[] dir[i];
+          dir[i] = NULL;
+     }
+     pages.clear();
+     sorted = true;
+}
 
-     // symbols in registers
-     v = ctx["eax"];
-     if (v->opr != NULL)
-          outputs.push_back(v);
-     v = ctx["ebx"];
-     if (v->opr != NULL)
-          outputs.push_back(v);
-     v = ctx["ecx"];
-     if (v->opr != NULL)
-          outputs.push_back(v);
-     v = ctx["edx"];
-     if (v->opr != NULL)
-          outputs.push_back(v);
+// Make this memory a copy of o. Pages are shared and copied on the first
+// write, so only the page tables are duplicated.
+void ShadowMem::share(const ShadowMem *o)
+{
+     if (o == this) return;
+
+     release();
+     for (int i = 0; i < 1 << (32 - MEMTBL_BITS - MEMPAGE_BITS); ++i) {
+          if (o->dir[i] == NULL) continue;
+          dir[i] = new MemPage*[MEMTBL_SIZE];
+          for (int j = 0; j < MEMTBL_SIZE; ++j) {
+               dir[i][j] = o->dir[i][j];
+               if (dir[i][j] != NULL) ++dir[i][j]->ref;
+          }
+     }
+     pages = o->pages;
+     sorted = o->sorted;
+}
 
-     // symbols in memory
-     for (auto const& x : mem) {
-          v = x.second;
-          if (v->opr != NULL)
-               outputs.push_back(v);
+// the slot of addr to be written, its page is allocated or copied if needed
+Value *&ShadowMem::operator[](uint32_t addr)
+{
+     MemPage **&tbl = dir[addr >> (MEMTBL_BITS + MEMPAGE_BITS)];
+     if (tbl == NULL)
+          tbl = new MemPage*[MEMTBL_SIZE]();
+
+     MemPage *&page = tbl[(addr >> MEMPAGE_BITS) & (MEMTBL_SIZE - 1)];
+     if (page == NULL) {
+          page = new MemPage();
+          if (!pages.empty() && pages.back() > addr >> MEMPAGE_BITS)
+               sorted = false;
+          pages.push_back(addr >> MEMPAGE_BITS);
+     } else if (page->ref > 1) {
+          --page->ref;
+          page = new MemPage(*page);
+          page->ref = 1;
      }
 
-     return outputs;
+     return page->slot[addr & (MEMPAGE_SIZE - 1)];
 }
 
-void SEEngine::printAllRegFormulas()
+// all written slots in address order, only the allocated pages are scanned
+void ShadowMem::getSlots(vector< pair<uint32_t, Value*> > *slots)
 {
-     cout << "eax: ";
-     outputFormula("eax");
-     printInputSymbols("eax");
-     cout << endl;
+     if (!sorted) {
+          sort(pages.begin(), pages.end());
+          sorted = true;
+     }
 
-     cout << "ebx: ";
-     outputFormula("ebx");
-     printInputSymbols("ebx");
-     cout << endl;
+     for (vector<uint32_t>::iterator it = pages.begin(); it != pages.end(); ++it) {
+          uint32_t base = *it << MEMPAGE_BITS;
+          MemPage *page = dir[*it >> MEMTBL_BITS][*it & (MEMTBL_SIZE - 1)];
+          for (int i = 0; i < MEMPAGE_SIZE; ++i) {
+               if (page->slot[i] != NULL)
+                    slots->push_back(make_pair(base + i, page->slot[i]));
+          }
+     }
+}
 
-     cout << "ecx: ";
-     outputFormula("ecx");
-     printInputSymbols("ecx");
-     cout << endl;
 
-     cout << "edx: ";
-     outputFormula("edx");
-     printInputSymbols("edx");
-     cout << endl;
+// Kinds of translated instructions. The operand kinds are resolved when an
+// instruction is translated, only the source of some kinds is left open.
+enum XKind {X_NOP, X_MSG, X_PUSH, X_PUSHMEM, X_POP, X_NEG, X_MOVREG, X_MOVMEM,
+            X_LEA, X_XCHGRR, X_XCHGMR, X_XCHGRM, X_OPREG, X_OPMEM, X_IMUL3};
+
+// a static instruction translated for symexec
+struct XInst {
+     uint8_t kind;
+     uint8_t srcty;             // Operand::OprTy of the source
+     bool fatal;                // X_MSG: stop the execution
+     int opty;
+     Operand *dst;              // operands of the first instance of the instruction
+     Operand *src;
+     Value *imm;                // immediate source
+     DiagSite *diag;            // X_MSG: counted when it is executed
+     DiagSite *unknown;         // reads of unknown memory values, NULL until the first one
+};
 
-     cout << "esi: ";
-     outputFormula("esi");
-     printInputSymbols("esi");
-     cout << endl;
+// a loop iteration executed once from fresh symbols
+enum SumOp {SUM_REG = 0x100, SUM_MEM, SUM_CONST};
 
-     cout << "edi: ";
-     outputFormula("edi");
-     printInputSymbols("edi");
-     cout << endl;
+// a node of a loop summary, operands are indexes of earlier nodes
+struct SumNode {
+     int op;                    // operator or SumOp
+     int a, b, c;               // SUM_REG: the register, SUM_MEM: the read
+     Value *con;                // SUM_CONST: the constant in the engine
+};
+
+// The transfer function of a loop iteration over the registers and memory.
+// Memory is identified by the position of an access in the iteration.
+struct LoopSummary {
+     vector<SumNode> code;
+     vector<int> inpos;                  // position of the instruction of each read
+     vector< pair<int, int> > regout;    // register, node
+     vector< pair<int, int> > memout;    // access, node
+};
+
+// the message of an instruction which is not executed
+void setXMsg(XInst *x, uint32_t addr, string msg, bool fatal)
+{
+     x->kind = X_MSG;
+     x->diag = getDiagSite(addr, msg);
+     x->fatal = fatal;
 }
 
-void SEEngine::printMemFormula()
+
+// class SEEngine Implementation
+SEEngine::SEEngine()
 {
-     for (auto const& x : mem) {
-          Value *v = x.second;
-          printf("%x: ", x.first);
-          cout << "sym" << v->id << "=" << endl;
-          traverse(v);
-          cout << endl << endl;
+     for (int i = 0; i < NREG; ++i) {
+          ctx[i] = NULL;
      }
+     arena = new NodeArena();
+     simp = true;
+     concrete = false;
+     slice = NULL;
+     summarize = false;
+     nodebudget = 0;
+     depthbudget = 0;
+     epoch = 0;
+     gclimit = gcthreshold;
 }
 
-set<Value*> *getInputs(Value *output)
+// all formulas built by the engine are released at once
+SEEngine::~SEEngine()
 {
-     queue<Value*> que;
-     que.push(output);
-
-     set<Value*> *inputset = new set<Value*>;
-
-     while (!que.empty()) {
-          Value *v = que.front();
-          Operation *op = v->opr;
-          que.pop();
-
-          if(op == NULL) {
-               if (v->valty == SYMBOL)
-                    inputset->insert(v);
-          } else {
-               for (int i = 0; i < 3; ++i) {
-                    if (op->val[i] != NULL) que.push(op->val[i]);
-               }
-          }
+     for (unordered_map<Value*, Tape*>::iterator it = tapes.begin(); it != tapes.end(); ++it) {
+          delete it->second;
+     }
+     for (unordered_map<uint32_t, XInst*>::iterator it = xcache.begin(); it != xcache.end(); ++it) {
+          delete it->second;
+     }
+     for (unordered_map<uint64_t, LoopSummary*>::iterator it = summaries.begin(); it != summaries.end(); ++it) {
+          delete it->second;
+     }
+     for (vector<Snapshot*>::iterator it = snaps.begin(); it != snaps.end(); ++it) {
+          delete *it;
      }
+     delete arena;
+}
+
+void SEEngine::init(Value *v1, Value *v2, Value *v3, Value *v4,
+                    Value *v5, Value *v6, Value *v7, Value *v8,
+                    list<Inst>::iterator it1,
+                    list<Inst>::iterator it2)
+{
+     ctx[EAX] = v1;
+     ctx[EBX] = v2;
+     ctx[ECX] = v3;
+     ctx[EDX] = v4;
+     ctx[ESI] = v5;
+     ctx[EDI] = v6;
+     ctx[ESP] = v7;
+     ctx[EBP] = v8;
 
-     return inputset;
+     this->start = it1;
+     this->end = it2;
 }
 
-void SEEngine::printInputSymbols(string output)
+void SEEngine::init(list<Inst>::iterator it1,
+                    list<Inst>::iterator it2)
 {
-     Value *v = ctx[output];
-     set<Value*> *insyms = getInputs(v);
+     this->start = it1;
+     this->end = it2;
+}
 
-     cout << insyms->size() << " input symbols: ";
-     for (set<Value*>::iterator it = insyms->begin(); it != insyms->end(); ++it) {
-          cout << "sym" << (*it)->id << " ";
+void SEEngine::initAllRegSymol(list<Inst>::iterator it1,
+                               list<Inst>::iterator it2)
+{
+     for (int i = EAX; i < NREG; ++i) {
+          ctx[i] = buildsym();
      }
-     cout << endl;
+
+     this->start = it1;
+     this->end = it2;
 }
 
-// Recursively evaluate a Value
-uint32_t eval(Value *v, map<Value*, uint32_t> *inmap)
+// Make only the registers in inregs and the memory in inranges [start, end)
+// symbolic. Other registers get their values before it1 in the trace, other
+// memory gets the values read by the trace when they can be recovered.
+void SEEngine::initInputs(list<Inst>::iterator it1,
+                          list<Inst>::iterator it2,
+                          set<int> *inregs,
+                          vector< pair<uint32_t, uint32_t> > *inranges)
 {
-     Operation *op = v->opr;
-     if (op == NULL) {
-          if (v->valty == CONCRETE)
-               return stoul(v->conval, 0, 16);
+     for (int i = EAX; i <= EBP; ++i) {
+          if (inregs->find(i) != inregs->end())
+               ctx[i] = buildsym();
           else
-               return (*inmap)[v];
-     } else {
-          uint32_t op0, op1;
-          // uint32_t op2;
-
-          if (op->val[0] != NULL) op0 = eval(op->val[0], inmap);
-          if (op->val[1] != NULL) op1 = eval(op->val[1], inmap);
-          // if (op->val[2] != NULL) op2 = eval(op->val[2], inmap);
-
-          if (op->opty == "add") {
-               return op0 + op1;
-          } else if (op->opty == "sub") {
-               return op0 - op1;
-          } else if (op->opty == "imul") {
-               return op0 * op1;
-          } else if (op->opty == "xor") {
-               return op0 ^ op1;
-          } else if (op->opty == "and") {
-               return op0 & op1;
-          } else if (op->opty == "or") {
-               return op0 | op1;
-          } else if (op->opty == "shl") {
-               return op0 << op1;
-          } else if (op->opty == "shr") {
-               return op0 >> op1;
-          } else if (op->opty == "neg") {
-               return ~op0 + 1;
-          } else if (op->opty == "inc") {
-               return op0 + 1;
-          } else {
-               cout << "Instruction: " << op->opty << "is not interpreted!" << endl;
-               return 1;
-          }
+               ctx[i] = buildcon(it1->ctxreg[i]);
+     }
+     // segment and FPU registers are not in the trace
+     for (int i = CS; i < NREG; ++i) {
+          ctx[i] = buildsym();
      }
+
+     concrete = true;
+     inmem = *inranges;
+
+     this->start = it1;
+     this->end = it2;
 }
 
-// Given inputs, concrete compute the output value of a formula
-uint32_t SEEngine::conexec(Value *f, map<Value*, uint32_t> *inmap)
+bool SEEngine::isInputMem(uint32_t addr)
 {
-     set<Value*> *inputsym = getInputs(f);
-     set<Value*> inmapkeys;
-     for (map<Value*, uint32_t>::iterator it = inmap->begin(); it != inmap->end(); ++it) {
-          inmapkeys.insert(it->first);
+     for (vector< pair<uint32_t, uint32_t> >::iterator it = inmem.begin(); it != inmem.end(); ++it) {
+          if (addr >= it->first && addr < it->second)
+               return true;
      }
 
-     if (inmapkeys != *inputsym) {
-          cout << "Some inputs don't have parameters!" << endl;
-          return 1;
-     }
-
-     return eval(f, inmap);
+     return false;
 }
 
-// build a map based on a var vector and a input vector
-map<Value*, uint32_t> buildinmap(vector<Value*> *vv, vector<uint32_t> *input)
+// Recover the value that the instruction it reads from memory. The trace only
+// records registers, so the value is the register it is loaded into, read at
+// the next instruction, or is computed back from an add, sub or xor result.
+bool SEEngine::tracedload(list<Inst>::iterator it, uint32_t *val)
 {
-     map<Value*, uint32_t> inmap;
-     if (vv->size() != input->size()) {
-          cout << "number of input symbols is wrong!" << endl;
-          return inmap;
+     list<Inst>::iterator next = std::next(it);
+     if (next == end || it->oprnum == 0) return false;
+
+     Operand *op0 = it->oprd[0];
+     Operand *op1 = it->oprnum > 1 ? it->oprd[1] : NULL;
+     string &opc = it->opcstr;
+
+     if (opc == "pop" && op0->ty == Operand::Reg) {
+          *val = next->getRegVal(op0);
+          return true;
+     }
+     if (op1 == NULL) return false;
+     if (opc == "xchg" && op0->ty == Operand::Mem && op1->ty == Operand::Reg) {
+          *val = next->getRegVal(op1);
+          return true;
      }
+     if (op0->ty != Operand::Reg || op1->ty != Operand::Mem) return false;
+
+     uint32_t before = it->getRegVal(op0);
+     uint32_t after = next->getRegVal(op0);
+     if (opc == "mov" || opc == "xchg")
+          *val = after;
+     else if (opc == "add")
+          *val = after - before;
+     else if (opc == "sub")
+          *val = before - after;
+     else if (opc == "xor")
+          *val = after ^ before;
+     else
+          return false;
+     if (op0->bit < 32)
+          *val &= (1u << op0->bit) - 1;
 
-     for (int i = 0, max = vv->size(); i < max; ++i) {
-          inmap.insert(pair<Value*,uint32_t>((*vv)[i], (*input)[i]));
+     return true;
+}
+
+// the value read from memory by it, an input symbol if it has not been written
+Value *SEEngine::memload(list<Inst>::iterator it)
+{
+     Value *v = mem.get(it->memaddr);
+     if (v != NULL) return v;
+
+     uint32_t val;
+     if (!concrete || isInputMem(it->memaddr)) {
+          v = buildsym();
+          memin.push_back(make_pair(v, it));
+     } else if (tracedload(it, &val)) {
+          v = buildcon(val);
+     } else {
+          XInst *x = translate(it);
+          if (x->unknown == NULL)
+               x->unknown = getDiagSite(it->addrn, "the value read from memory is unknown, it is kept symbolic");
+          diagHit(x->unknown);
+          v = buildsym();
      }
+     mem[it->memaddr] = v;
 
-     return inmap;
+     return v;
+}
+
+// Save the registers and memory. Memory pages are shared with the engine
+// until one side writes them. The snapshot belongs to the engine, its
+// formulas are kept by collect until it is dropped.
+Snapshot *SEEngine::snapshot()
+{
+     Snapshot *snap = new Snapshot();
+     for (int i = 0; i < NREG; ++i) {
+          snap->ctx[i] = ctx[i];
+     }
+     snap->mem.share(&mem);
+     snap->nmemin = memin.size();
+     snap->ncuts = cuts.size();
+     snaps.push_back(snap);
+     return snap;
+}
+
+void SEEngine::dropSnapshot(Snapshot *snap)
+{
+     snaps.erase(find(snaps.begin(), snaps.end(), snap));
+     delete snap;
+}
+
+// Go back to a snapshot of this engine, e.g. to execute another suffix of a
+// trace or other inputs from the same state. Formulas built since the
+// snapshot stay in the engine, but the memory inputs read and the cuts made
+// since are forgotten, and a cut subformula is built again when it recurs.
+void SEEngine::restore(Snapshot *snap)
+{
+     for (int i = 0; i < NREG; ++i) {
+          ctx[i] = snap->ctx[i];
+     }
+     mem.share(&snap->mem);
+
+     memin.resize(snap->nmemin);
+     for (size_t i = snap->ncuts; i < cuts.size(); ++i) {
+          Operation *op = cuts[i].second->opr;
+          OpKey key = {op->opty, {op->val[0], op->val[1], op->val[2]}};
+          optable.erase(key);
+     }
+     cuts.resize(snap->ncuts);
+}
+
+// instructions which have no effect in symbolic execution
+set<string> noeffectinst = {"test","jmp","jz","jbe","jo","jno","js","jns","je","jne",
+                            "jnz","jb","jnae","jc","jnb","jae",
+                            "jnc","jna","ja","jnbe","jl",
+                            "jnge","jge","jnl","jle","jng","jg",
+                            "jnle","jp","jpe","jnp","jpo","jcxz",
+                            "jecxz"};
+
+// copy the formula v of another engine into this engine, the values in done
+// are already copied or substituted
+Value *SEEngine::import(Value *v, unordered_map<Value*, Value*> *done)
+{
+     if (v == NULL) return NULL;
+
+     unordered_map<Value*, Value*>::iterator it = done->find(v);
+     if (it != done->end()) return it->second;
+
+     Value *res;
+     Operation *op = v->opr;
+     if (op == NULL) {
+          res = v->valty == CONCRETE ? buildcon(v->conval) : buildsym();
+     } else {
+          Value *v1 = import(op->val[0], done);
+          Value *v2 = import(op->val[1], done);
+          Value *v3 = import(op->val[2], done);
+          if (v3 != NULL)
+               res = buildop3(op->opty, v1, v2, v3);
+          else if (v2 != NULL)
+               res = buildop2(op->opty, v1, v2);
+          else
+               res = buildop1(op->opty, v1);
+     }
+
+     done->insert(make_pair(v, res));
+     return res;
+}
+
+// Append a segment executed by seg to this engine. The registers seg started
+// from (inregs) and the memory it read before writing are replaced by their
+// values at the end of this engine.
+void SEEngine::compose(SEEngine *seg, Value **inregs)
+{
+     unordered_map<Value*, Value*> done;
+     for (int i = EAX; i < NREG; ++i) {
+          done[inregs[i]] = ctx[i];
+     }
+     for (vector< pair<Value*, list<Inst>::iterator> >::iterator it = seg->memin.begin(); it != seg->memin.end(); ++it) {
+          done[it->first] = memload(it->second);
+     }
+
+     // the cut-point symbols of seg stand for their subformulas, which are cut
+     // again by the budgets of this engine; a cut only refers to earlier cuts
+     for (vector< pair<Value*, Value*> >::iterator it = seg->cuts.begin(); it != seg->cuts.end(); ++it) {
+          done[it->first] = import(it->second, &done);
+     }
+
+     // all outputs are imported before any location is updated
+     Value *regs[NREG];
+     for (int i = 0; i < NREG; ++i) {
+          regs[i] = seg->ctx[i] == NULL ? ctx[i] : import(seg->ctx[i], &done);
+     }
+     vector< pair<uint32_t, Value*> > slots;
+     seg->mem.getSlots(&slots);
+     for (vector< pair<uint32_t, Value*> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+          it->second = import(it->second, &done);
+     }
+
+     for (int i = 0; i < NREG; ++i) {
+          ctx[i] = regs[i];
+     }
+     for (vector< pair<uint32_t, Value*> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+          mem[it->first] = it->second;
+     }
+}
+
+// Execute the trace in nseg segments on their own threads. This engine runs
+// the first segment, every other segment runs in a new engine from fresh
+// symbols, and the segments are composed in order at the end.
+int SEEngine::symexecParallel(int nseg)
+{
+     int n = distance(start, end);
+     if (nseg <= 1 || n < nseg) return symexec();
+
+     vector< list<Inst>::iterator > bounds;
+     list<Inst>::iterator it = start;
+     for (int k = 0; k < nseg; ++k) {
+          bounds.push_back(it);
+          advance(it, n / nseg + (k < n % nseg ? 1 : 0));
+     }
+     bounds.push_back(end);
+
+     vector<SEEngine*> segs(nseg, NULL);
+     vector< vector<Value*> > inregs(nseg, vector<Value*>(NREG, NULL));
+     vector< vector<bool> > segslice(nseg);
+     vector<int> ret(nseg, 0);
+     vector<thread> threads;
+     int pos = distance(bounds[0], bounds[1]);
+     for (int k = 1; k < nseg; ++k) {
+          SEEngine *se = new SEEngine();
+          se->setSimplify(simp);
+          se->setSummarize(summarize);
+          se->setBudget(nodebudget, depthbudget);
+          se->initAllRegSymol(bounds[k], bounds[k+1]);
+          for (int i = EAX; i < NREG; ++i) {
+               inregs[k][i] = se->ctx[i];
+          }
+
+          int len = distance(bounds[k], bounds[k+1]);
+          if (slice != NULL) {
+               segslice[k].assign(slice->begin() + pos, slice->begin() + pos + len);
+               se->setSlice(&segslice[k]);
+          }
+          pos += len;
+
+          segs[k] = se;
+          threads.push_back(thread([&ret, se, k]() { ret[k] = se->symexec(); }));
+     }
+
+     // the first segment runs on this engine
+     list<Inst>::iterator last = end;
+     end = bounds[1];
+     ret[0] = symexec();
+     end = last;
+
+     int err = ret[0];
+     for (int k = 1; k < nseg; ++k) {
+          threads[k-1].join();
+          if (ret[k] != 0) err = ret[k];
+     }
+     for (int k = 1; k < nseg; ++k) {
+          if (err == 0) compose(segs[k], &inregs[k][0]);
+          delete segs[k];
+     }
+
+     return err;
+}
+
+// value of the register operand op, a sub-register is cut out of its register
+Value *SEEngine::getReg(Operand *op)
+{
+     Value *v = ctx[op->regid[0]];
+     if (op->bit >= 32 || op->regid[0] > EBP || v == NULL) return v;
+
+     if (op->regoff != 0)
+          v = buildop2(SHR, v, buildcon(op->regoff));
+     return buildop2(AND, v, buildcon((1u << op->bit) - 1));
+}
+
+// write the register operand op, a sub-register keeps the other bits
+void SEEngine::setReg(Operand *op, Value *v)
+{
+     Value *&r = ctx[op->regid[0]];
+     if (op->bit >= 32 || op->regid[0] > EBP || r == NULL) {
+          r = v;
+          return;
+     }
+
+     uint32_t mask = ((1u << op->bit) - 1) << op->regoff;
+     v = buildop2(AND, v, buildcon(mask >> op->regoff));
+     if (op->regoff != 0)
+          v = buildop2(SHL, v, buildcon(op->regoff));
+     r = buildop2(OR, buildop2(AND, r, buildcon(~mask)), v);
+}
+
+// Translate the instruction it once for all instances of its address
+XInst *SEEngine::translate(list<Inst>::iterator it)
+{
+     unordered_map<uint32_t, XInst*>::iterator i = xcache.find(it->addrn);
+     if (i != xcache.end()) return i->second;
+
+     XInst *x = new XInst();
+     xcache[it->addrn] = x;
+     x->kind = X_NOP;
+     x->fatal = false;
+     x->dst = it->oprnum > 0 ? it->oprd[0] : NULL;
+     x->src = it->oprnum > 1 ? it->oprd[1] : NULL;
+     x->srcty = x->src != NULL ? x->src->ty : Operand::ImmValue;
+     x->imm = NULL;
+     x->unknown = NULL;
+
+     // skip no effect instructions
+     if (noeffectinst.find(it->opcstr) != noeffectinst.end()) return x;
+
+     // an operand which is not parsed has no value to execute with
+     for (int i = 0; i < it->oprnum && i < 3; ++i) {
+          if (it->oprd[i]->ty == Operand::Invalid) {
+               setXMsg(x, it->addrn, "operand " + to_string(i + 1) + " is not parsed!", false);
+               return x;
+          }
+     }
+
+     Operand *op0 = x->dst;
+     Operand *op1 = x->src;
+     switch (it->oprnum) {
+     case 0:
+          break;
+     case 1:
+          if (it->opcstr == "push") {
+               if (op0->ty == Operand::ImmValue) {
+                    x->kind = X_PUSH;
+                    x->srcty = Operand::ImmValue;
+                    x->imm = buildcon(stoul(op0->field[0], 0, 16));
+               } else if (op0->ty == Operand::Reg) {
+                    x->kind = X_PUSH;
+                    x->srcty = Operand::Reg;
+                    x->src = op0;
+               } else if (op0->ty == Operand::Mem) {
+                    // The memaddr in the trace is the read address
+                    // We need to compute the write address
+                    x->kind = X_PUSHMEM;
+               } else {
+                    setXMsg(x, it->addrn, "push error: the operand is not Imm, Reg or Mem!", true);
+               }
+          } else if (it->opcstr == "pop") {
+               if (op0->ty == Operand::Reg)
+                    x->kind = X_POP;
+               else
+                    setXMsg(x, it->addrn, "pop error: the operand is not Reg!", true);
+          } else if (it->opcstr == "neg") {
+               if (op0->ty == Operand::Reg) {
+                    x->kind = X_NEG;
+                    x->opty = getOpTy(it->opcstr);
+               } else if (op0->ty == Operand::Mem) {
+                    setXMsg(x, it->addrn, "neg error: the operand is not Reg!", true);
+               }
+          } else {
+               setXMsg(x, it->addrn, "instruction " + it->opcstr + " is not handled!", false);
+          }
+          break;
+     case 2:
+          if (it->opcstr == "mov") { // handle mov instruction
+               if (op0->ty == Operand::Reg) {
+                    if (op1->ty == Operand::ImmValue || op1->ty == Operand::Reg || op1->ty == Operand::Mem)
+                         x->kind = X_MOVREG;
+                    else
+                         setXMsg(x, it->addrn, "op1 is not ImmValue, Reg or Mem", true);
+               } else if (op0->ty == Operand::Mem) {
+                    if (op1->ty == Operand::ImmValue || op1->ty == Operand::Reg)
+                         x->kind = X_MOVMEM;
+               } else {
+                    setXMsg(x, it->addrn, "Error: The first operand in MOV is not Reg or Mem!", false);
+               }
+          } else if (it->opcstr == "lea") { // handle lea instruction
+               /* lea reg, ptr [edx+eax*1]
+                  interpret lea instruction based on different address type
+                  1. op0 must be reg
+                  2. op1 must be addr
+                */
+               if (op0->ty != Operand::Reg || op1->ty != Operand::Mem) {
+                    setXMsg(x, it->addrn, "lea format error!", false);
+               } else if (op1->tag == 5) {
+                    x->kind = X_LEA;
+                    x->imm = buildcon(stoul(op1->field[2], 0, 16));
+               } else {
+                    setXMsg(x, it->addrn, "Other tags in addr is not ready for lea!", false);
+               }
+          } else if (it->opcstr == "xchg") {
+               if (op1->ty == Operand::Reg) {
+                    if (op0->ty == Operand::Reg)
+                         x->kind = X_XCHGRR; // xchg reg, reg
+                    else if (op0->ty == Operand::Mem)
+                         x->kind = X_XCHGMR; // xchg mem, reg
+                    else
+                         setXMsg(x, it->addrn, "xchg error: 1", false);
+               } else if (op1->ty == Operand::Mem) {
+                    if (op0->ty == Operand::Reg)
+                         x->kind = X_XCHGRM; // xchg reg, mem
+                    else
+                         setXMsg(x, it->addrn, "xchg error 3", false);
+               } else {
+                    setXMsg(x, it->addrn, "xchg error: 2", false);
+               }
+          } else { // handle other instructions
+               if (op1->ty != Operand::ImmValue && op1->ty != Operand::Reg && op1->ty != Operand::Mem) {
+                    setXMsg(x, it->addrn, "other instructions: op1 is not ImmValue, Reg, or Mem!", true);
+               } else if (op0->ty == Operand::Reg) { // dest op is reg
+                    x->kind = X_OPREG;
+                    x->opty = getOpTy(it->opcstr);
+               } else if (op0->ty == Operand::Mem) { // dest op is mem
+                    x->kind = X_OPMEM;
+                    x->opty = getOpTy(it->opcstr);
+               } else {
+                    setXMsg(x, it->addrn, "other instructions: op2 is not ImmValue, Reg, or Mem!", true);
+               }
+          }
+          if (x->kind != X_MSG && x->kind != X_LEA && op1->ty == Operand::ImmValue)
+               x->imm = buildcon(stoul(op1->field[0], 0, 16));
+          break;
+     case 3:
+          // three operands instructions are reduced to two operands
+          if (it->opcstr == "imul" && op0->ty == Operand::Reg &&
+              op1->ty == Operand::Reg && it->oprd[2]->ty == Operand::ImmValue) { // imul reg, reg, imm
+               x->kind = X_IMUL3;
+               x->opty = getOpTy(it->opcstr);
+               x->imm = buildcon(stoul(it->oprd[2]->field[0], 0, 16));
+          } else {
+               setXMsg(x, it->addrn, "three operands instructions other than imul are not handled!", false);
+          }
+          break;
+     default:
+          setXMsg(x, it->addrn, "all instructions: number of operands is larger than 4!", false);
+          break;
+     }
+
+     return x;
+}
+
+// the source value of a translated instruction
+inline Value *SEEngine::xsrc(XInst *x, list<Inst>::iterator it)
+{
+     if (x->srcty == Operand::ImmValue)
+          return x->imm;
+     else if (x->srcty == Operand::Reg)
+          return getReg(x->src);
+     else
+          return memload(it);
+}
+
+// Execute the instructions [from, to) without the slice or loop summaries,
+// e.g. the suffix of a trace after a snapshot
+int SEEngine::symexecRange(list<Inst>::iterator from, list<Inst>::iterator to)
+{
+     vector<bool> *s = slice;
+     slice = NULL;
+     int ret = execRange(from, to, 0);
+     slice = s;
+     return ret;
+}
+
+int SEEngine::symexec()
+{
+     if (summarize)
+          return execLoop();
+     else
+          return execRange(start, end, 0);
+}
+
+// Execute the instructions [from, to), pos is the position of from in the
+// slice. Every static instruction is translated once, an instance only
+// dispatches on the kind of its translation.
+int SEEngine::execRange(list<Inst>::iterator from, list<Inst>::iterator to, int pos)
+{
+     for (list<Inst>::iterator it = from; it != to; ++it) {
+          // all state is in registers and memory between instructions
+          if (gclimit > 0 && arena->values.live() > gclimit) {
+               collect();
+               gclimit = max((size_t)gcthreshold, 2 * arena->values.live());
+          }
+
+          // skip instructions out of the slice
+          if (slice != NULL && !(*slice)[pos++]) continue;
+
+          XInst *x = translate(it);
+          Value *v0, *v1;
+          switch (x->kind) {
+          case X_NOP:
+               break;
+          case X_MSG:
+               diagHit(x->diag);
+               if (x->fatal) return 1;
+               break;
+          case X_PUSH:
+               mem[it->memaddr] = xsrc(x, it);
+               break;
+          case X_PUSHMEM:
+               v0 = memload(it);
+               mem[it->ctxreg[ESP]-4] = v0;
+               break;
+          case X_POP:
+               setReg(x->dst, memload(it));
+               break;
+          case X_NEG:
+               setReg(x->dst, buildop1(x->opty, getReg(x->dst)));
+               break;
+          case X_MOVREG:
+               setReg(x->dst, xsrc(x, it));
+               break;
+          case X_MOVMEM:
+               mem[it->memaddr] = xsrc(x, it);
+               break;
+          case X_LEA:
+               v0 = ctx[x->src->regid[0]];
+               v1 = buildop2(IMUL, ctx[x->src->regid[1]], x->imm);
+               setReg(x->dst, buildop2(ADD, v0, v1));
+               break;
+          case X_XCHGRR:
+               v1 = getReg(x->src);
+               v0 = getReg(x->dst);
+               setReg(x->src, v0);
+               setReg(x->dst, v1);
+               break;
+          case X_XCHGMR:
+               v1 = getReg(x->src);
+               v0 = memload(it);
+               setReg(x->src, v0);
+               mem[it->memaddr] = v1;
+               break;
+          case X_XCHGRM:
+               v1 = memload(it);
+               v0 = getReg(x->dst);
+               setReg(x->dst, v1);
+               mem[it->memaddr] = v0;
+               break;
+          case X_OPREG:
+               v1 = xsrc(x, it);
+               v0 = getReg(x->dst);
+               setReg(x->dst, buildop2(x->opty, v0, v1));
+               break;
+          case X_OPMEM:
+               v1 = xsrc(x, it);
+               v0 = memload(it);
+               mem[it->memaddr] = buildop2(x->opty, v0, v1);
+               break;
+          case X_IMUL3:
+               setReg(x->dst, buildop2(x->opty, getReg(x->src), x->imm));
+               break;
+          }
+     }
+     return 0;
+}
+
+// the location of the source of a translated instruction, false for an immediate
+static bool xsrcLoc(XInst *x, list<Inst>::iterator it, Loc *loc)
+{
+     if (x->srcty == Operand::Reg)
+          *loc = x->src->regid[0];
+     else if (x->srcty == Operand::Mem)
+          *loc = LOC_MEM(it->memaddr);
+     else
+          return false;
+     return true;
+}
+
+// define the register op, a sub-register keeps the other bits of its register
+static void defReg(DefUse *d, Operand *op)
+{
+     d->def.push_back(op->regid[0]);
+     if (op->bit < 32 && op->regid[0] <= EBP)
+          d->use.push_back(op->regid[0]);
+}
+
+// The locations each instruction of [from, to) defines and uses when
+// execRange runs its translation. Instructions which are not executed have
+// none, a fatal message stops the execution and is always kept.
+void SEEngine::buildDefUse(list<Inst>::iterator from, list<Inst>::iterator to, vector<DefUse> *du)
+{
+     for (list<Inst>::iterator it = from; it != to; ++it) {
+          du->push_back(DefUse());
+          DefUse *d = &du->back();
+          d->stop = false;
+
+          XInst *x = translate(it);
+          Loc loc;
+          Loc m = LOC_MEM(it->memaddr);
+          switch (x->kind) {
+          case X_NOP:
+               break;
+          case X_MSG:
+               d->stop = x->fatal;
+               break;
+          case X_PUSH:
+          case X_MOVMEM:
+               if (xsrcLoc(x, it, &loc)) d->use.push_back(loc);
+               d->def.push_back(m);
+               break;
+          case X_PUSHMEM:
+               d->use.push_back(m);
+               d->def.push_back(LOC_MEM(it->ctxreg[ESP] - 4));
+               break;
+          case X_POP:
+               d->use.push_back(m);
+               defReg(d, x->dst);
+               break;
+          case X_NEG:
+               d->use.push_back(x->dst->regid[0]);
+               defReg(d, x->dst);
+               break;
+          case X_MOVREG:
+               if (xsrcLoc(x, it, &loc)) d->use.push_back(loc);
+               defReg(d, x->dst);
+               break;
+          case X_LEA:
+               d->use.push_back(x->src->regid[0]);
+               d->use.push_back(x->src->regid[1]);
+               defReg(d, x->dst);
+               break;
+          case X_XCHGRR:
+               d->use.push_back(x->src->regid[0]);
+               d->use.push_back(x->dst->regid[0]);
+               defReg(d, x->src);
+               defReg(d, x->dst);
+               break;
+          case X_XCHGMR:
+               d->use.push_back(x->src->regid[0]);
+               d->use.push_back(m);
+               defReg(d, x->src);
+               d->def.push_back(m);
+               break;
+          case X_XCHGRM:
+               d->use.push_back(x->dst->regid[0]);
+               d->use.push_back(m);
+               defReg(d, x->dst);
+               d->def.push_back(m);
+               break;
+          case X_OPREG:
+               if (xsrcLoc(x, it, &loc)) d->use.push_back(loc);
+               d->use.push_back(x->dst->regid[0]);
+               defReg(d, x->dst);
+               break;
+          case X_OPMEM:
+               if (xsrcLoc(x, it, &loc)) d->use.push_back(loc);
+               d->use.push_back(m);
+               d->def.push_back(m);
+               break;
+          case X_IMUL3:
+               d->use.push_back(x->src->regid[0]);
+               defReg(d, x->dst);
+               break;
+          }
+     }
+}
+
+// Summarize the iteration [from, to) at position pos: execute it in a new
+// engine from fresh registers and memory, and compile the formulas of the
+// registers and memory it writes. NULL if the execution stops in the
+// iteration.
+LoopSummary *SEEngine::buildSummary(list<Inst>::iterator from, list<Inst>::iterator to, int pos,
+                                    vector<uint32_t> *access)
+{
+     SEEngine se;
+     se.setSimplify(simp);
+     se.initAllRegSymol(from, to);
+     Value *inregs[NREG];
+     for (int i = 0; i < NREG; ++i) {
+          inregs[i] = se.ctx[i];
+     }
+
+     vector<bool> segslice;
+     if (slice != NULL) {
+          segslice.assign(slice->begin() + pos, slice->begin() + pos + distance(from, to));
+          se.setSlice(&segslice);
+     }
+     if (se.execRange(from, to, 0) != 0) return NULL;
+
+     // only the registers the outputs depend on get a node
+     LoopSummary *sum = new LoopSummary();
+     unordered_map<Value*, int> node;
+     unordered_map<Value*, int> regof;
+     for (int i = EAX; i < NREG; ++i) {
+          regof[inregs[i]] = i;
+     }
+     unordered_map<Inst*, int> posof;
+     int i = 0;
+     for (list<Inst>::iterator it = from; it != to; ++it) {
+          posof[&*it] = i++;
+     }
+     for (vector< pair<Value*, list<Inst>::iterator> >::iterator it = se.memin.begin(); it != se.memin.end(); ++it) {
+          SumNode n = {SUM_MEM, (int)sum->inpos.size(), -1, -1, NULL};
+          node[it->first] = sum->code.size();
+          sum->code.push_back(n);
+          sum->inpos.push_back(posof[&*it->second]);
+     }
+
+     // outputs: changed registers and written memory
+     vector< pair<int, Value*> > regs, mems;
+     for (int i = 0; i < NREG; ++i) {
+          if (se.ctx[i] != inregs[i])
+               regs.push_back(make_pair(i, se.ctx[i]));
+     }
+     vector< pair<uint32_t, Value*> > slots;
+     se.mem.getSlots(&slots);
+     for (vector< pair<uint32_t, Value*> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+          int j = 0;
+          while ((*access)[j] != it->first) ++j;
+          mems.push_back(make_pair(j, it->second));
+     }
+
+     // compile the outputs in operand order, like compileTape
+     vector< pair<int, Value*> > *outs[2] = {&regs, &mems};
+     for (int k = 0; k < 2; ++k) {
+          for (vector< pair<int, Value*> >::iterator out = outs[k]->begin(); out != outs[k]->end(); ++out) {
+               vector< pair<Value*, bool> > stack;
+               stack.push_back(make_pair(out->second, false));
+               while (!stack.empty()) {
+                    Value *v = stack.back().first;
+                    if (node.find(v) != node.end()) {
+                         stack.pop_back();
+                         continue;
+                    }
+
+                    Operation *op = v->opr;
+                    SumNode n = {SUM_CONST, -1, -1, -1, NULL};
+                    if (op == NULL) {
+                         // symbols are all registers or reads
+                         unordered_map<Value*, int>::iterator r = regof.find(v);
+                         if (r != regof.end()) {
+                              n.op = SUM_REG;
+                              n.a = r->second;
+                         } else {
+                              n.con = v->valty == CONCRETE ? buildcon(v->conval) : buildsym();
+                         }
+                    } else if (!stack.back().second) {
+                         stack.back().second = true;
+                         for (int i = 2; i >= 0; --i) {
+                              if (op->val[i] != NULL && node.find(op->val[i]) == node.end())
+                                   stack.push_back(make_pair(op->val[i], false));
+                         }
+                         continue;
+                    } else {
+                         n.op = op->opty;
+                         n.a = node[op->val[0]];
+                         n.b = op->val[1] != NULL ? node[op->val[1]] : -1;
+                         n.c = op->val[2] != NULL ? node[op->val[2]] : -1;
+                    }
+
+                    node[v] = sum->code.size();
+                    sum->code.push_back(n);
+                    stack.pop_back();
+               }
+               if (k == 0)
+                    sum->regout.push_back(make_pair(out->first, node[out->second]));
+               else
+                    sum->memout.push_back(make_pair(out->first, node[out->second]));
+          }
+     }
+
+     return sum;
+}
+
+// apply the summary sum to the iteration [from, to) which accesses access
+void SEEngine::applySummary(LoopSummary *sum, list<Inst>::iterator from, list<Inst>::iterator to,
+                            vector<uint32_t> *access)
+{
+     vector<Value*> &in = sumin;
+     in.clear();
+     list<Inst>::iterator it = from;
+     int pos = 0;
+     for (vector<int>::iterator p = sum->inpos.begin(); p != sum->inpos.end(); ++p) {
+          advance(it, *p - pos);
+          pos = *p;
+          in.push_back(memload(it));
+     }
+
+     vector<Value*> &val = sumval;
+     val.resize(sum->code.size());
+     for (int i = 0, max = sum->code.size(); i < max; ++i) {
+          SumNode *n = &sum->code[i];
+          if (n->op == SUM_REG)
+               val[i] = ctx[n->a];
+          else if (n->op == SUM_MEM)
+               val[i] = in[n->a];
+          else if (n->op == SUM_CONST)
+               val[i] = n->con;
+          else if (n->c >= 0)
+               val[i] = buildop3(n->op, val[n->a], val[n->b], val[n->c]);
+          else if (n->b >= 0)
+               val[i] = buildop2(n->op, val[n->a], val[n->b]);
+          else
+               val[i] = buildop1(n->op, val[n->a]);
+     }
+
+     for (vector< pair<int, int> >::iterator out = sum->regout.begin(); out != sum->regout.end(); ++out) {
+          ctx[out->first] = val[out->second];
+     }
+     for (vector< pair<int, int> >::iterator out = sum->memout.begin(); out != sum->memout.end(); ++out) {
+          mem[(*access)[out->first]] = val[out->second];
+     }
+}
+
+// continue the FNV-1a style hash h with the word w
+static inline uint64_t hashWord(uint64_t h, uint64_t w)
+{
+     return (h ^ w) * 1099511628211ull;
+}
+
+// Execute the trace iteration by iteration. The loop head is the target of
+// the most frequent backward jump, the head of the innermost loop in nested
+// loops. An iteration which follows the path and the memory alias pattern
+// of an earlier iteration is executed by applying the summary of these
+// iterations to the current registers and memory.
+int SEEngine::execLoop()
+{
+     unordered_map<uint32_t, int> count;
+     uint32_t headaddr = 0;
+     int most = 0;
+     uint32_t last = start->addrn;
+     for (list<Inst>::iterator it = start; it != end; ++it) {
+          if (it->addrn <= last && it != start) {
+               int n = ++count[it->addrn];
+               if (n > most) {
+                    most = n;
+                    headaddr = it->addrn;
+               }
+          }
+          last = it->addrn;
+     }
+     if (most == 0) return execRange(start, end, 0);
+
+     list<Inst>::iterator head = start;
+     while (head->addrn != headaddr) ++head;
+
+     int pos = distance(start, head);
+     if (execRange(start, head, 0) != 0) return 1;
+
+     vector<uint32_t> access;
+     unordered_map<uint32_t, uint32_t> alias;
+     unordered_set<uint64_t> failed;      // keys of iterations which cannot be summarized
+     while (head != end) {
+          // the key hashes the path with the slice, and the alias class of
+          // every memory access: the first access to an address opens a class
+          uint64_t path = 14695981039346656037ull;
+          int len = 0;
+          list<Inst>::iterator next = head;
+          access.clear();
+          do {
+               path = hashWord(path, slice != NULL && (*slice)[pos + len] ? next->addrn | 1ull << 32 : next->addrn);
+               if (next->memaddr != 0) {
+                    access.push_back(next->memaddr);
+                    if (translate(next)->kind == X_PUSHMEM)
+                         access.push_back(next->ctxreg[ESP] - 4);
+               }
+               ++len;
+               ++next;
+          } while (next != end && next->addrn != headaddr);
+          alias.clear();
+          uint64_t cls = 14695981039346656037ull;
+          for (vector<uint32_t>::iterator a = access.begin(); a != access.end(); ++a) {
+               cls = hashWord(cls, alias.insert(make_pair(*a, alias.size())).first->second);
+          }
+          uint64_t key = hashWord(path, cls);
+
+          // An iteration is summarized when its key is seen the second time.
+          // It is executed when it is seen first or cannot be summarized.
+          LoopSummary *sum = NULL;
+          unordered_map<uint64_t, LoopSummary*>::iterator s = summaries.find(key);
+          if (s == summaries.end()) {
+               summaries[key] = NULL;
+          } else {
+               if (s->second == NULL && failed.find(key) == failed.end()) {
+                    s->second = buildSummary(head, next, pos, &access);
+                    if (s->second == NULL) failed.insert(key);
+               }
+               sum = s->second;
+          }
+
+          if (sum != NULL)
+               applySummary(sum, head, next, &access);
+          else if (execRange(head, next, pos) != 0)
+               return 1;
+
+          pos += len;
+          head = next;
+     }
+
+     return 0;
+}
+
+// mark v and the nodes it is built from as reached in this epoch
+void SEEngine::markFrom(Value *v, vector<Value*> *stack)
+{
+     stack->push_back(v);
+     while (!stack->empty()) {
+          v = stack->back();
+          stack->pop_back();
+          if (v == NULL || v->mark == epoch) continue;
+
+          v->mark = epoch;
+          if (v->opr != NULL) {
+               for (int i = 0; i < 3; ++i) {
+                    stack->push_back(v->opr->val[i]);
+               }
+          }
+     }
+}
+
+// Release the nodes which cannot be reached from the registers, the memory,
+// the snapshots, the kept outputs, the symbols and the translated or
+// summarized instructions. Formulas held anywhere else are invalid after a
+// collection. Return the number of released nodes.
+int SEEngine::collect()
+{
+     if (++epoch == 0) epoch = 1;
+
+     vector<Value*> stack;
+     for (int i = 0; i < NREG; ++i) {
+          markFrom(ctx[i], &stack);
+     }
+     vector< pair<uint32_t, Value*> > slots;
+     mem.getSlots(&slots);
+     for (vector< pair<uint32_t, Value*> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+          markFrom(it->second, &stack);
+     }
+     for (vector<Snapshot*>::iterator s = snaps.begin(); s != snaps.end(); ++s) {
+          for (int i = 0; i < NREG; ++i) {
+               markFrom((*s)->ctx[i], &stack);
+          }
+          slots.clear();
+          (*s)->mem.getSlots(&slots);
+          for (vector< pair<uint32_t, Value*> >::iterator it = slots.begin(); it != slots.end(); ++it) {
+               markFrom(it->second, &stack);
+          }
+     }
+     for (vector<Value*>::iterator it = kept.begin(); it != kept.end(); ++it) {
+          markFrom(*it, &stack);
+     }
+     for (vector<Value*>::iterator it = syms.begin(); it != syms.end(); ++it) {
+          markFrom(*it, &stack);
+     }
+     for (vector< pair<Value*, Value*> >::iterator it = cuts.begin(); it != cuts.end(); ++it) {
+          markFrom(it->second, &stack);
+     }
+     for (unordered_map<uint32_t, XInst*>::iterator it = xcache.begin(); it != xcache.end(); ++it) {
+          markFrom(it->second->imm, &stack);
+     }
+     for (unordered_map<uint64_t, LoopSummary*>::iterator it = summaries.begin(); it != summaries.end(); ++it) {
+          if (it->second == NULL) continue;
+          for (vector<SumNode>::iterator n = it->second->code.begin(); n != it->second->code.end(); ++n) {
+               markFrom(n->con, &stack);
+          }
+     }
+
+     // forget the dead nodes in the tables and caches
+     for (unordered_map<OpKey, Value*, OpKeyHash>::iterator it = optable.begin(); it != optable.end(); ) {
+          if (it->second->mark != epoch)
+               it = optable.erase(it);
+          else
+               ++it;
+     }
+     for (unordered_map<uint32_t, Value*>::iterator it = contable.begin(); it != contable.end(); ) {
+          if (it->second->mark != epoch)
+               it = contable.erase(it);
+          else
+               ++it;
+     }
+     for (unordered_map<Value*, Tape*>::iterator it = tapes.begin(); it != tapes.end(); ) {
+          if (it->first->mark != epoch) {
+               delete it->second;
+               it = tapes.erase(it);
+          } else {
+               ++it;
+          }
+     }
+     for (unordered_map<Value*, SymSet>::iterator it = insets.begin(); it != insets.end(); ) {
+          if (it->first->mark != epoch)
+               it = insets.erase(it);
+          else
+               ++it;
+     }
+
+     int n = 0;
+     for (size_t i = 0, max = arena->values.size(); i < max; ++i) {
+          Value *v = arena->values.at(i);
+          if (v->valty == FREE || v->mark == epoch) continue;
+
+          if (v->opr != NULL)
+               arena->opers.release(v->opr);
+          v->valty = FREE;
+          v->opr = NULL;
+          arena->values.release(v);
+          ++n;
+     }
+
+     return n;
+}
+
+void traverse(Value *v)
+{
+     if (v == NULL) return;
+
+     Operation *op = v->opr;
+     if (op == NULL) {
+          if (v->valty == CONCRETE)
+               cout << getValueName(v);
+          else
+               cout << "sym" << v->id;
+     } else {
+          cout << "(" << opnames[op->opty] << " ";
+          traverse(op->val[0]);
+          cout << " ";
+          traverse(op->val[1]);
+          cout << ")";
+     }
+}
+
+void SEEngine::outputFormula(int reg)
+{
+     Value *v = ctx[reg];
+     cout << "sym" << v->id << "=" << '\n';
+     traverse(v);
+     cout << '\n';
+}
+
+vector<Value*> SEEngine::getAllOutput()
+{
+     vector<Value*> outputs;
+     Value *v;
+
+     // symbols in registers
+     v = ctx[EAX];
+     if (v->opr != NULL)
+          outputs.push_back(v);
+     v = ctx[EBX];
+     if (v->opr != NULL)
+          outputs.push_back(v);
+     v = ctx[ECX];
+     if (v->opr != NULL)
+          outputs.push_back(v);
+     v = ctx[EDX];
+     if (v->opr != NULL)
+          outputs.push_back(v);
+
+     // symbols in memory
+     vector< pair<uint32_t, Value*> > slots;
+     mem.getSlots(&slots);
+     for (auto const& x : slots) {
+          v = x.second;
+          if (v->opr != NULL)
+               outputs.push_back(v);
+     }
+
+     return outputs;
+}
+
+void SEEngine::printAllRegFormulas()
+{
+     cout << "eax: ";
+     outputFormula(EAX);
+     printInputSymbols(EAX);
+     cout << '\n';
+
+     cout << "ebx: ";
+     outputFormula(EBX);
+     printInputSymbols(EBX);
+     cout << '\n';
+
+     cout << "ecx: ";
+     outputFormula(ECX);
+     printInputSymbols(ECX);
+     cout << '\n';
+
+     cout << "edx: ";
+     outputFormula(EDX);
+     printInputSymbols(EDX);
+     cout << '\n';
+
+     cout << "esi: ";
+     outputFormula(ESI);
+     printInputSymbols(ESI);
+     cout << '\n';
+
+     cout << "edi: ";
+     outputFormula(EDI);
+     printInputSymbols(EDI);
+     cout << '\n';
+}
+
+void SEEngine::printMemFormula()
+{
+     vector< pair<uint32_t, Value*> > slots;
+     mem.getSlots(&slots);
+     for (auto const& x : slots) {
+          Value *v = x.second;
+          printf("%x: ", x.first);
+          cout << "sym" << v->id << "=" << '\n';
+          traverse(v);
+          cout << '\n' << '\n';
+     }
 }
 
-// get all inputs of formula f and push them into a vector
-vector<Value*> getInputVector(Value *f)
+// Input symbols of f as a bitset over symbol numbers. The sets of all
+// operations below f are computed once and kept by the engine.
+const SymSet *SEEngine::getInputSet(Value *f)
 {
-     set<Value*> *inset = getInputs(f);
+     unordered_map<Value*, SymSet>::iterator it = insets.find(f);
+     if (it != insets.end())
+          return &it->second;
+
+     vector< pair<Value*, bool> > stack;  // value, operands pushed
+     stack.push_back(make_pair(f, false));
+     while (!stack.empty()) {
+          Value *v = stack.back().first;
+          if (insets.find(v) != insets.end()) {
+               stack.pop_back();
+               continue;
+          }
+
+          Operation *op = v->opr;
+          SymSet set;
+          if (op == NULL) {
+               if (v->valty == SYMBOL) {
+                    set.resize(v->symno / 64 + 1);
+                    set[v->symno / 64] |= 1ull << (v->symno % 64);
+               }
+          } else if (!stack.back().second) {
+               stack.back().second = true;
+               for (int i = 0; i < 3; ++i) {
+                    if (op->val[i] != NULL && insets.find(op->val[i]) == insets.end())
+                         stack.push_back(make_pair(op->val[i], false));
+               }
+               continue;
+          } else {
+               for (int i = 0; i < 3; ++i) {
+                    if (op->val[i] == NULL) continue;
+                    SymSet *s = &insets[op->val[i]];
+                    if (s->size() > set.size()) set.resize(s->size());
+                    for (int w = 0, max = s->size(); w < max; ++w) {
+                         set[w] |= (*s)[w];
+                    }
+               }
+          }
+
+          insets[v].swap(set);
+          stack.pop_back();
+     }
+
+     return &insets[f];
+}
 
+// get all inputs of formula f ordered by their symbol numbers
+vector<Value*> SEEngine::getInputVector(Value *f)
+{
+     const SymSet *set = getInputSet(f);
      vector<Value*> vv;
-     for (set<Value*>::iterator it = inset->begin(); it != inset->end(); ++it) {
-          vv.push_back(*it);
+
+     for (int w = 0, max = set->size(); w < max; ++w) {
+          for (uint64_t bits = (*set)[w]; bits != 0; bits &= bits - 1) {
+               vv.push_back(syms[w * 64 + __builtin_ctzll(bits)]);
+          }
      }
 
      return vv;
 }
 
+void SEEngine::printInputSymbols(int output)
+{
+     Value *v = ctx[output];
+     vector<Value*> insyms = getInputVector(v);
+
+     cout << insyms.size() << " input symbols: ";
+     for (vector<Value*>::iterator it = insyms.begin(); it != insyms.end(); ++it) {
+          cout << "sym" << (*it)->id << " ";
+     }
+     cout << '\n';
+}
+
+// Compile the formula f into a tape. Shared subformulas are compiled once and
+// the formula is walked with an explicit stack, so deep formulas are fine.
+Tape *compileTape(Value *f)
+{
+     Tape *t = new Tape();
+     unordered_map<Value*, uint32_t> slot;
+     vector< pair<Value*, bool> > stack;  // value, operands pushed
+
+     stack.push_back(make_pair(f, false));
+     while (!stack.empty()) {
+          Value *v = stack.back().first;
+          if (slot.find(v) != slot.end()) {
+               stack.pop_back();
+               continue;
+          }
+
+          Operation *op = v->opr;
+          TapeInst ti;
+          if (op == NULL) {
+               if (v->valty == CONCRETE) {
+                    ti.op = TAPE_CONST;
+                    ti.a = v->conval;
+               } else {
+                    ti.op = TAPE_INPUT;
+                    ti.a = t->inputs.size();
+                    t->inputs.push_back(v);
+               }
+               ti.b = 0;
+          } else if (!stack.back().second) {
+               // compile the operands first
+               stack.back().second = true;
+               for (int i = 1; i >= 0; --i) {
+                    if (op->val[i] != NULL && slot.find(op->val[i]) == slot.end())
+                         stack.push_back(make_pair(op->val[i], false));
+               }
+               continue;
+          } else if (op->opty < NINTERP) {
+               ti.op = op->opty;
+               ti.a = slot[op->val[0]];
+               ti.b = op->val[1] != NULL ? slot[op->val[1]] : ti.a;
+          } else {
+               diag(0, "Instruction: " + opnames[op->opty] + " is not interpreted!");
+               ti.op = TAPE_UNKNOWN;
+               ti.a = ti.b = 0;
+          }
+
+          slot[v] = t->code.size();
+          t->code.push_back(ti);
+          stack.pop_back();
+     }
+     t->regs.resize(t->code.size());
+
+     return t;
+}
+
+// run a tape on the input values in, which are ordered as t->inputs
+uint32_t runTape(Tape *t, const uint32_t *in)
+{
+     uint32_t *r = t->regs.data();
+     const TapeInst *code = t->code.data();
+
+     for (size_t i = 0, n = t->code.size(); i < n; ++i) {
+          const TapeInst *ti = &code[i];
+          switch (ti->op) {
+          case TAPE_CONST: r[i] = ti->a; break;
+          case TAPE_INPUT: r[i] = in[ti->a]; break;
+          case ADD: r[i] = r[ti->a] + r[ti->b]; break;
+          case SUB: r[i] = r[ti->a] - r[ti->b]; break;
+          case IMUL: r[i] = r[ti->a] * r[ti->b]; break;
+          case XOR: r[i] = r[ti->a] ^ r[ti->b]; break;
+          case AND: r[i] = r[ti->a] & r[ti->b]; break;
+          case OR: r[i] = r[ti->a] | r[ti->b]; break;
+          case SHL: r[i] = r[ti->a] << (r[ti->b] & 0x1f); break;
+          case SHR: r[i] = r[ti->a] >> (r[ti->b] & 0x1f); break;
+          case NEG: r[i] = ~r[ti->a] + 1; break;
+          case INC: r[i] = r[ti->a] + 1; break;
+          default: r[i] = 1; break;
+          }
+     }
+
+     return r[t->code.size() - 1];
+}
+
+// the tape of formula f, compiled on first use
+Tape *SEEngine::getTape(Value *f)
+{
+     unordered_map<Value*, Tape*>::iterator it = tapes.find(f);
+     if (it != tapes.end())
+          return it->second;
+
+     Tape *t = compileTape(f);
+     tapes.insert(make_pair(f, t));
+     return t;
+}
+
+Tape::~Tape()
+{
+#ifdef __x86_64__
+     if (jitmem != NULL) munmap(jitmem, jitsize);
+#endif
+}
+
+#ifdef __x86_64__
+void emit32(vector<uint8_t> *c, uint32_t v)
+{
+     for (int i = 0; i < 4; ++i) {
+          c->push_back((v >> (8 * i)) & 0xff);
+     }
+}
+
+// Compile a tape to x86-64 code. The function gets the inputs in rdi and the
+// slots in rsi: every operation loads its operands into eax and ecx, computes
+// in eax and stores eax to its slot. The last result is returned in eax.
+void jitTape(Tape *t)
+{
+     vector<uint8_t> c;
+
+     for (size_t i = 0, n = t->code.size(); i < n; ++i) {
+          const TapeInst *ti = &t->code[i];
+          if (ti->op == TAPE_CONST) {
+               c.push_back(0xb8);                   // mov eax, imm32
+               emit32(&c, ti->a);
+          } else if (ti->op == TAPE_INPUT) {
+               c.push_back(0x8b); c.push_back(0x87); // mov eax, [rdi+disp32]
+               emit32(&c, ti->a * 4);
+          } else if (ti->op == TAPE_UNKNOWN) {
+               c.push_back(0xb8);
+               emit32(&c, 1);
+          } else {
+               c.push_back(0x8b); c.push_back(0x86); // mov eax, [rsi+disp32]
+               emit32(&c, ti->a * 4);
+               c.push_back(0x8b); c.push_back(0x8e); // mov ecx, [rsi+disp32]
+               emit32(&c, ti->b * 4);
+               switch (ti->op) {
+               case ADD: c.push_back(0x01); c.push_back(0xc8); break; // add eax, ecx
+               case SUB: c.push_back(0x29); c.push_back(0xc8); break; // sub eax, ecx
+               case IMUL: c.push_back(0x0f); c.push_back(0xaf); c.push_back(0xc1); break; // imul eax, ecx
+               case XOR: c.push_back(0x31); c.push_back(0xc8); break; // xor eax, ecx
+               case AND: c.push_back(0x21); c.push_back(0xc8); break; // and eax, ecx
+               case OR: c.push_back(0x09); c.push_back(0xc8); break;  // or eax, ecx
+               case SHL: c.push_back(0xd3); c.push_back(0xe0); break; // shl eax, cl
+               case SHR: c.push_back(0xd3); c.push_back(0xe8); break; // shr eax, cl
+               case NEG: c.push_back(0xf7); c.push_back(0xd8); break; // neg eax
+               case INC: c.push_back(0xff); c.push_back(0xc0); break; // inc eax
+               }
+          }
+          c.push_back(0x89); c.push_back(0x86);      // mov [rsi+disp32], eax
+          emit32(&c, i * 4);
+     }
+     c.push_back(0xc3);                             // ret
+
+     // the code is written to a writable page, which is then made executable
+     size_t size = (c.size() + 4095) & ~(size_t)4095;
+     void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+     if (mem == MAP_FAILED) return;
+     memcpy(mem, c.data(), c.size());
+     if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+          munmap(mem, size);
+          return;
+     }
+
+     t->jitmem = mem;
+     t->jitsize = size;
+     t->jit = (uint32_t (*)(const uint32_t *, uint32_t *))mem;
+}
+#else
+// no native code on other architectures, the interpreter is used
+void jitTape(Tape *t) {}
+#endif
+
+// count n runs of a tape and compile it once it is hot, true if it has native code
+bool hotTape(Tape *t, uint32_t n)
+{
+     if (jitthreshold < 0) return false;
+
+     uint32_t before = t->nrun;
+     t->nrun += n;
+     if (t->jit == NULL && before <= (uint32_t)jitthreshold && t->nrun > (uint32_t)jitthreshold)
+          jitTape(t);
+     return t->jit != NULL;
+}
+
+// run a tape with the native code once it is hot
+uint32_t execTape(Tape *t, const uint32_t *in)
+{
+     if (hotTape(t, 1))
+          return t->jit(in, t->regs.data());
+     else
+          return runTape(t, in);
+}
+
+// Given inputs, concrete compute the output value of a formula
+uint32_t SEEngine::conexec(Value *f, map<Value*, uint32_t> *inmap)
+{
+     Tape *t = getTape(f);
+     vector<uint32_t> in(t->inputs.size());
+
+     if (inmap->size() != t->inputs.size()) {
+          diag(0, "Some inputs don't have parameters!");
+          return 1;
+     }
+     for (int i = 0, max = t->inputs.size(); i < max; ++i) {
+          map<Value*, uint32_t>::iterator it = inmap->find(t->inputs[i]);
+          if (it == inmap->end()) {
+               diag(0, "Some inputs don't have parameters!");
+               return 1;
+          }
+          in[i] = it->second;
+     }
+
+     return execTape(t, in.data());
+}
+
+// Check once that the inputs of f are in iv and prepare the evaluation of f
+// on input rows ordered as iv
+int SEEngine::prepare(Value *f, vector<Value*> *iv, EvalCtx *ec)
+{
+     const SymSet *need = getInputSet(f);
+     SymSet have(need->size());
+     for (vector<Value*>::iterator it = iv->begin(); it != iv->end(); ++it) {
+          int n = (*it)->symno;
+          if (n >= 0 && n / 64 < (int)have.size())
+               have[n / 64] |= 1ull << (n % 64);
+     }
+     for (int w = 0, max = need->size(); w < max; ++w) {
+          if (((*need)[w] & ~have[w]) != 0) {
+               diag(0, "Some inputs don't have parameters!");
+               return 1;
+          }
+     }
+
+     ec->tape = getTape(f);
+     ec->inpos.resize(ec->tape->inputs.size());
+     for (int k = 0, max = ec->inpos.size(); k < max; ++k) {
+          ec->inpos[k] = find(iv->begin(), iv->end(), ec->tape->inputs[k]) - iv->begin();
+     }
+     ec->row.resize(ec->inpos.size());
+
+     return 0;
+}
+
+// evaluate a prepared formula on one input row in, ordered as the iv of prepare
+uint32_t SEEngine::conexec(EvalCtx *ec, const uint32_t *in)
+{
+     for (int k = 0, max = ec->inpos.size(); k < max; ++k) {
+          ec->row[k] = in[ec->inpos[k]];
+     }
+
+     return execTape(ec->tape, ec->row.data());
+}
+
+// Time n runs of formula f on random inputs with the interpreter, the native
+// code and the batched evaluation
+void SEEngine::benchFormula(Value *f, int n)
+{
+     Tape *t = getTape(f);
+     int nin = t->inputs.size();
+     vector<uint32_t> in(nin * n), out(n);
+     uint32_t seed = 2463534242u;
+
+     for (int i = 0, max = in.size(); i < max; ++i) {
+          seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+          in[i] = seed;
+     }
+
+     // runTape and jit take the inputs of a row, conexecBatch takes columns
+     vector<uint32_t> rows(nin * n);
+     for (int i = 0; i < n; ++i) {
+          for (int k = 0; k < nin; ++k) {
+               rows[i*nin + k] = in[k*n + i];
+          }
+     }
+
+     clock_t c0 = clock();
+     uint32_t sum1 = 0;
+     for (int i = 0; i < n; ++i) {
+          sum1 += runTape(t, &rows[i*nin]);
+     }
+
+     clock_t c1 = clock();
+     uint32_t sum2 = 0;
+     if (t->jit == NULL) jitTape(t);
+     if (t->jit != NULL) {
+          for (int i = 0; i < n; ++i) {
+               sum2 += t->jit(&rows[i*nin], t->regs.data());
+          }
+     }
+
+     clock_t c2 = clock();
+     uint32_t sum3 = 0;
+     int oldthreshold = jitthreshold;
+     jitthreshold = -1;         // time the SIMD evaluation, not the native code
+     conexecBatch(f, &t->inputs, in.data(), n, out.data());
+     jitthreshold = oldthreshold;
+     for (int i = 0; i < n; ++i) {
+          sum3 += out[i];
+     }
+     clock_t c3 = clock();
+
+     printf("%lu ops, %d inputs, %d runs: interpreter %.3fs", t->code.size(), nin, n,
+            (double)(c1 - c0) / CLOCKS_PER_SEC);
+     if (t->jit != NULL)
+          printf(", jit %.3fs%s", (double)(c2 - c1) / CLOCKS_PER_SEC, sum2 == sum1 ? "" : " (MISMATCH)");
+     else
+          printf(", jit not available");
+     printf(", batch %.3fs%s\n", (double)(c3 - c2) / CLOCKS_PER_SEC, sum3 == sum1 ? "" : " (MISMATCH)");
+}
+
+#ifdef __SSE2__
+// The 8 lane kernel is compiled for AVX2 whatever the build flags are, and
+// conexecBatch only calls it when the CPU has AVX2.
+static bool hasAVX2()
+{
+     __builtin_cpu_init();
+     return __builtin_cpu_supports("avx2");
+}
+
+static const bool cpuavx2 = hasAVX2();
+
+// run a tape on 8 rows, in[k] points to the values of input k
+__attribute__((target("avx2")))
+void runTape8(Tape *t, const uint32_t **in, __m256i *r, uint32_t *out)
+{
+     const TapeInst *code = t->code.data();
+     size_t n = t->code.size();
+     __m256i mask = _mm256_set1_epi32(0x1f);
+
+     for (size_t i = 0; i < n; ++i) {
+          const TapeInst *ti = &code[i];
+          switch (ti->op) {
+          case TAPE_CONST: r[i] = _mm256_set1_epi32(ti->a); break;
+          case TAPE_INPUT: r[i] = _mm256_loadu_si256((const __m256i *)in[ti->a]); break;
+          case ADD: r[i] = _mm256_add_epi32(r[ti->a], r[ti->b]); break;
+          case SUB: r[i] = _mm256_sub_epi32(r[ti->a], r[ti->b]); break;
+          case IMUL: r[i] = _mm256_mullo_epi32(r[ti->a], r[ti->b]); break;
+          case XOR: r[i] = _mm256_xor_si256(r[ti->a], r[ti->b]); break;
+          case AND: r[i] = _mm256_and_si256(r[ti->a], r[ti->b]); break;
+          case OR: r[i] = _mm256_or_si256(r[ti->a], r[ti->b]); break;
+          case SHL: r[i] = _mm256_sllv_epi32(r[ti->a], _mm256_and_si256(r[ti->b], mask)); break;
+          case SHR: r[i] = _mm256_srlv_epi32(r[ti->a], _mm256_and_si256(r[ti->b], mask)); break;
+          case NEG: r[i] = _mm256_sub_epi32(_mm256_setzero_si256(), r[ti->a]); break;
+          case INC: r[i] = _mm256_add_epi32(r[ti->a], _mm256_set1_epi32(1)); break;
+          default: r[i] = _mm256_set1_epi32(1); break;
+          }
+     }
+     _mm256_storeu_si256((__m256i *)out, r[n - 1]);
+}
+#endif
+
+#ifdef __SSE2__
+// SSE2 has no 32-bit multiply and no per-lane shift count
+__m128i mullo4(__m128i a, __m128i b)
+{
+     __m128i even = _mm_mul_epu32(a, b);
+     __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+     return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                               _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__m128i shift4(__m128i a, __m128i b, int opty)
+{
+     uint32_t va[4], vb[4];
+     _mm_storeu_si128((__m128i *)va, a);
+     _mm_storeu_si128((__m128i *)vb, b);
+     for (int j = 0; j < 4; ++j) {
+          va[j] = opty == SHL ? va[j] << (vb[j] & 0x1f) : va[j] >> (vb[j] & 0x1f);
+     }
+     return _mm_loadu_si128((const __m128i *)va);
+}
+
+// run a tape on 4 rows, in[k] points to the values of input k
+void runTape4(Tape *t, const uint32_t **in, __m128i *r, uint32_t *out)
+{
+     const TapeInst *code = t->code.data();
+     size_t n = t->code.size();
+
+     for (size_t i = 0; i < n; ++i) {
+          const TapeInst *ti = &code[i];
+          switch (ti->op) {
+          case TAPE_CONST: r[i] = _mm_set1_epi32(ti->a); break;
+          case TAPE_INPUT: r[i] = _mm_loadu_si128((const __m128i *)in[ti->a]); break;
+          case ADD: r[i] = _mm_add_epi32(r[ti->a], r[ti->b]); break;
+          case SUB: r[i] = _mm_sub_epi32(r[ti->a], r[ti->b]); break;
+          case IMUL: r[i] = mullo4(r[ti->a], r[ti->b]); break;
+          case XOR: r[i] = _mm_xor_si128(r[ti->a], r[ti->b]); break;
+          case AND: r[i] = _mm_and_si128(r[ti->a], r[ti->b]); break;
+          case OR: r[i] = _mm_or_si128(r[ti->a], r[ti->b]); break;
+          case SHL:
+          case SHR: r[i] = shift4(r[ti->a], r[ti->b], ti->op); break;
+          case NEG: r[i] = _mm_sub_epi32(_mm_setzero_si128(), r[ti->a]); break;
+          case INC: r[i] = _mm_add_epi32(r[ti->a], _mm_set1_epi32(1)); break;
+          default: r[i] = _mm_set1_epi32(1); break;
+          }
+     }
+     _mm_storeu_si128((__m128i *)out, r[n - 1]);
+}
+#endif
+
+// Evaluate formula f on n rows at once. The value of input iv[k] in row i is
+// in[k*n + i], the result of row i goes to out[i]. Hot formulas run as native
+// code row by row, the others in SIMD lanes where the CPU allows it.
+int SEEngine::conexecBatch(Value *f, vector<Value*> *iv, const uint32_t *in, int n, uint32_t *out)
+{
+     EvalCtx ec;
+     if (prepare(f, iv, &ec) != 0)
+          return 1;
+
+     Tape *t = ec.tape;
+     int nin = t->inputs.size();
+     vector<const uint32_t*> col(nin);
+     for (int k = 0; k < nin; ++k) {
+          col[k] = in + ec.inpos[k] * n;
+     }
+
+     int i = 0;
+     vector<uint32_t> row(nin);
+     if (hotTape(t, n)) {
+          for (; i < n; ++i) {
+               for (int k = 0; k < nin; ++k) {
+                    row[k] = *col[k]++;
+               }
+               out[i] = t->jit(row.data(), t->regs.data());
+          }
+          return 0;
+     }
+
+#ifdef __SSE2__
+     if (n >= 8 && cpuavx2) {
+          __m256i *r = (__m256i *)_mm_malloc(t->code.size() * sizeof(__m256i), 32);
+          for (; i + 8 <= n; i += 8) {
+               runTape8(t, col.data(), r, out + i);
+               for (int k = 0; k < nin; ++k) col[k] += 8;
+          }
+          _mm_free(r);
+     }
+#endif
+#ifdef __SSE2__
+     if (n - i >= 4) {
+          __m128i *r = (__m128i *)_mm_malloc(t->code.size() * sizeof(__m128i), 16);
+          for (; i + 4 <= n; i += 4) {
+               runTape4(t, col.data(), r, out + i);
+               for (int k = 0; k < nin; ++k) col[k] += 4;
+          }
+          _mm_free(r);
+     }
+#endif
+     for (; i < n; ++i) {
+          for (int k = 0; k < nin; ++k) {
+               row[k] = *col[k]++;
+          }
+          out[i] = runTape(t, row.data());
+     }
+
+     return 0;
+}
+
+// build a map based on a var vector and a input vector
+map<Value*, uint32_t> buildinmap(vector<Value*> *vv, vector<uint32_t> *input)
+{
+     map<Value*, uint32_t> inmap;
+     if (vv->size() != input->size()) {
+          diag(0, "number of input symbols is wrong!");
+          return inmap;
+     }
+
+     for (int i = 0, max = vv->size(); i < max; ++i) {
+          inmap.insert(pair<Value*,uint32_t>((*vv)[i], (*input)[i]));
+     }
+
+     return inmap;
+}
 
 // a post fix in symbol names to identify they are coming from different formulas
 string sympostfix;
@@ -660,57 +2387,56 @@ void outputCVC(Value *v, FILE *fp)
 
      Operation *op = v->opr;
      if (op == NULL) {
-          if (v->valty == CONCRETE) {
-               uint32_t i = stoul(v->conval, 0, 16);
-               fprintf(fp, "0hex%08x", i);
-          } else
+          if (v->valty == CONCRETE)
+               fprintf(fp, "0hex%08x", v->conval);
+          else
                fprintf(fp, "sym%d%s", v->id, sympostfix.c_str());
      } else {
-          if (op->opty == "add") {
+          if (op->opty == ADD) {
                fprintf(fp, "BVPLUS(32, ");
                outputCVC(op->val[0], fp);
                fprintf(fp, ", ");
                outputCVC(op->val[1], fp);
                fprintf(fp, ")");
-          } else if (op->opty == "sub") {
+          } else if (op->opty == SUB) {
                fprintf(fp, "BVSUB(32, ");
                outputCVC(op->val[0], fp);
                fprintf(fp, ", ");
                outputCVC(op->val[1], fp);
                fprintf(fp, ")");
-          } else if (op->opty == "imul") {
+          } else if (op->opty == IMUL) {
                fprintf(fp, "BVMULT(32, ");
                outputCVC(op->val[0], fp);
                fprintf(fp, ", ");
                outputCVC(op->val[1], fp);
                fprintf(fp, ")");
-          } else if (op->opty == "xor") {
+          } else if (op->opty == XOR) {
                fprintf(fp, "BVXOR(");
                outputCVC(op->val[0], fp);
                fprintf(fp, ", ");
                outputCVC(op->val[1], fp);
                fprintf(fp, ")");
-          } else if (op->opty == "and") {
+          } else if (op->opty == AND) {
                outputCVC(op->val[0], fp);
                fprintf(fp, " & ");
                outputCVC(op->val[1], fp);
-          } else if (op->opty == "or") {
+          } else if (op->opty == OR) {
                outputCVC(op->val[0], fp);
                fprintf(fp, " | ");
                outputCVC(op->val[1], fp);
-          } else if (op->opty == "neg") {
+          } else if (op->opty == NEG) {
                fprintf(fp, "~");
                outputCVC(op->val[0], fp);
-          } else if (op->opty == "shl") {
+          } else if (op->opty == SHL) {
                outputCVC(op->val[0], fp);
                fprintf(fp, " << ");
                outputCVC(op->val[1], fp);
-          } else if (op->opty == "shr") {
+          } else if (op->opty == SHR) {
                outputCVC(op->val[0], fp);
                fprintf(fp, " >> ");
                outputCVC(op->val[1], fp);
           } else {
-               cout << "Instruction: " << op->opty << " is not interpreted in CVC!" << endl;
+               diag(0, "Instruction: " + opnames[op->opty] + " is not interpreted in CVC!");
                return;
           }
      }
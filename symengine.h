@@ -1,30 +1,179 @@
 struct Operation;
 struct Value;
+struct NodeArena;
+struct Tape;
+struct XInst;
+struct LoopSummary;
+struct DefUse;
+
+// a set of symbols, bit n is the symbol numbered n in its engine
+typedef vector<uint64_t> SymSet;
+
+// a formula prepared to be evaluated on input rows
+struct EvalCtx {
+     Tape *tape;
+     vector<int> inpos;         // position of each tape input in the row
+     vector<uint32_t> row;      // inputs in the order of the tape
+};
+
+// Shadow memory of an engine: a two-level page table of 4 KiB pages with a
+// slot for every byte address. Pages are allocated when they are first written.
+#define MEMPAGE_BITS 12
+#define MEMTBL_BITS 10
+#define MEMPAGE_SIZE (1 << MEMPAGE_BITS)
+#define MEMTBL_SIZE (1 << MEMTBL_BITS)
+
+struct MemPage {
+     Value *slot[MEMPAGE_SIZE];
+     int ref;                   // number of memories sharing the page
+
+     MemPage() : slot(), ref(1) {}
+};
+
+class ShadowMem {
+private:
+     MemPage **dir[1 << (32 - MEMTBL_BITS - MEMPAGE_BITS)];
+     vector<uint32_t> pages;    // numbers of the allocated pages
+     bool sorted;
+
+     void release();
+
+public:
+     ShadowMem();
+     ~ShadowMem();
+     ShadowMem(const ShadowMem &) = delete;
+     ShadowMem &operator=(const ShadowMem &) = delete;
+
+     // the value at addr, NULL if it has not been written
+     Value *get(uint32_t addr) {
+          MemPage **tbl = dir[addr >> (MEMTBL_BITS + MEMPAGE_BITS)];
+          if (tbl == NULL) return NULL;
+          MemPage *page = tbl[(addr >> MEMPAGE_BITS) & (MEMTBL_SIZE - 1)];
+          if (page == NULL) return NULL;
+          return page->slot[addr & (MEMPAGE_SIZE - 1)];
+     }
+     Value *&operator[](uint32_t addr);
+     void getSlots(vector< pair<uint32_t, Value*> > *slots);
+     void share(const ShadowMem *o);
+};
+
+// saved registers and memory of an engine, the input symbols and cuts made
+// after the snapshot are dropped when it is restored
+struct Snapshot {
+     Value *ctx[NREG];
+     ShadowMem mem;
+     size_t nmemin;
+     size_t ncuts;
+};
+
+// key of an operation node in the hash-consing table
+struct OpKey {
+     int opty;
+     Value *val[3];
+
+     bool operator==(const OpKey &k) const {
+          return opty == k.opty && val[0] == k.val[0] && val[1] == k.val[1] && val[2] == k.val[2];
+     }
+};
+
+struct OpKeyHash {
+     size_t operator()(const OpKey &k) const {
+          size_t h = k.opty;
+          for (int i = 0; i < 3; ++i) {
+               h = h * 31 + hash<Value*>()(k.val[i]);
+          }
+          return h;
+     }
+};
 
 // Symbolic execution engine
 class SEEngine {
 private:
-     // Value *eax, *ebx, *ecx, *edx, *esi, *edi, *esp, *ebp;
-     map<string, Value*> ctx;
+     Value *ctx[NREG];          // registers by RegId
      list<Inst>::iterator start;
      list<Inst>::iterator end;
-     map<uint32_t, Value*> mem;
-
-     bool memfind(uint32_t addr) {
-          map<uint32_t, Value*>::iterator ii = mem.find(addr);
-          if (ii == mem.end())
-               return false;
-          else
-               return true;
-     }
+     ShadowMem mem;
+
+     // all nodes of the engine, released when the engine is destroyed
+     NodeArena *arena;
+
+     // structurally identical nodes are built only once
+     unordered_map<OpKey, Value*, OpKeyHash> optable;
+     unordered_map<uint32_t, Value*> contable;
+
+     Value *buildop1(int opty, Value *v1);
+     Value *buildop2(int opty, Value *v1, Value *v2);
+     Value *buildop3(int opty, Value *v1, Value *v2, Value *v3);
+     Value *buildcon(uint32_t con);
+     Value *buildsym();
+
+     // formulas are simplified as they are built
+     bool simp;
+     Value *simplifyop(int opty, Value *v1, Value *v2);
+     Value *rewrite(Value *v, unordered_map<Value*, Value*> *done);
+
+     // formulas larger than the budgets are cut, 0 for no budget
+     uint32_t nodebudget;
+     int depthbudget;
+     vector< pair<Value*, Value*> > cuts; // cut-point symbol and the subformula it stands for
+     Value *cutpoint(Value *v);
+
+     Value *getReg(Operand *op);
+     void setReg(Operand *op, Value *v);
+
+     // symbols of memory read before it is written and the reading instructions
+     vector< pair<Value*, list<Inst>::iterator> > memin;
+     Value *import(Value *v, unordered_map<Value*, Value*> *done);
+     void compose(SEEngine *seg, Value **inregs);
+
+     // Dead nodes are collected in epochs: a collection marks the nodes
+     // reachable from the roots with the new epoch and releases the others
+     uint8_t epoch;
+     size_t gclimit;
+     vector<Value*> kept;
+     vector<Snapshot*> snaps;
+     void markFrom(Value *v, vector<Value*> *stack);
+
+     // formulas compiled for concrete execution
+     unordered_map<Value*, Tape*> tapes;
+
+     // symbols by number and the input symbols of each formula
+     vector<Value*> syms;
+     unordered_map<Value*, SymSet> insets;
+
+     // Trace-guided concretization: only the declared input registers and
+     // memory ranges are symbols, other values are taken from the trace
+     bool concrete;
+     vector< pair<uint32_t, uint32_t> > inmem;
+
+     // static instructions translated for symexec, by address
+     unordered_map<uint32_t, XInst*> xcache;
+     XInst *translate(list<Inst>::iterator it);
+     Value *xsrc(XInst *x, list<Inst>::iterator it);
+
+     // instructions executed by symexec, all if NULL
+     vector<bool> *slice;
+     int execRange(list<Inst>::iterator from, list<Inst>::iterator to, int pos);
+
+     // summaries of loop iterations by path and memory alias pattern
+     bool summarize;
+     unordered_map<uint64_t, LoopSummary*> summaries;
+     vector<Value*> sumin, sumval;        // reads and nodes of the applied summary
+     LoopSummary *buildSummary(list<Inst>::iterator from, list<Inst>::iterator to, int pos,
+                               vector<uint32_t> *access);
+     void applySummary(LoopSummary *sum, list<Inst>::iterator from, list<Inst>::iterator to,
+                       vector<uint32_t> *access);
+     int execLoop();
+     bool isInputMem(uint32_t addr);
+     bool tracedload(list<Inst>::iterator it, uint32_t *val);
+     Value *memload(list<Inst>::iterator it);
 
 
 public:
-     SEEngine() {
-          ctx = { {"eax", NULL}, {"ebx", NULL}, {"ecx", NULL}, {"edx", NULL},
-                  {"esi", NULL}, {"edi", NULL}, {"esp", NULL}, {"ebp", NULL}
-          };
-     };
+     SEEngine();
+     ~SEEngine();
+     SEEngine(const SEEngine &) = delete;
+     SEEngine &operator=(const SEEngine &) = delete;
      void init(Value *v1, Value *v2, Value *v3, Value *v4,
                Value *v5, Value *v6, Value *v7, Value *v8,
                list<Inst>::iterator it1,
@@ -33,20 +182,47 @@ public:
                list<Inst>::iterator it2);
      void initAllRegSymol(list<Inst>::iterator it1,
                           list<Inst>::iterator it2);
+     void initInputs(list<Inst>::iterator it1,
+                     list<Inst>::iterator it2,
+                     set<int> *inregs,
+                     vector< pair<uint32_t, uint32_t> > *inranges);
+     void buildDefUse(list<Inst>::iterator from, list<Inst>::iterator to, vector<DefUse> *du);
+     void setSlice(vector<bool> *s) { slice = s; }
+     void setSummarize(bool on) { summarize = on; }
      int symexec();
+     int symexecParallel(int nseg);
+     int symexecRange(list<Inst>::iterator from, list<Inst>::iterator to);
+     Snapshot *snapshot();
+     void restore(Snapshot *snap);
+     void dropSnapshot(Snapshot *snap);
+     void keep(Value *v) { kept.push_back(v); }
+     int collect();
+     void simplify();
+     void setSimplify(bool on) { simp = on; }
+     void setBudget(uint32_t nodes, int depth) { nodebudget = nodes; depthbudget = depth; }
+     vector< pair<Value*, Value*> > getCuts() { return cuts; }
+     Tape *getTape(Value *f);
      uint32_t conexec(Value *f, map<Value*, uint32_t> *input);
-     void outputFormula(string reg);
+     int prepare(Value *f, vector<Value*> *iv, EvalCtx *ec);
+     uint32_t conexec(EvalCtx *ec, const uint32_t *in);
+     int conexecBatch(Value *f, vector<Value*> *iv, const uint32_t *in, int n, uint32_t *out);
+     void benchFormula(Value *f, int n);
+     void outputFormula(int reg);
      void printAllRegFormulas();
      void printMemFormula();
-     void printInputSymbols(string output);
-     Value *getValue(string s) { return ctx[s]; }
+     void printInputSymbols(int output);
+     const SymSet *getInputSet(Value *f);
+     vector<Value*> getInputVector(Value *f); // get formula f's inputs as a vector
+     Value *getValue(int reg) { return ctx[reg]; }
      vector<Value*> getAllOutput();
 };
 
+extern int jitthreshold;
+extern int gcthreshold;
+
 void outputCVCFormula(Value *f);
 void outputChkEqCVC(Value *f1, Value *f2, map<int,int> *m);
 void outputBitCVC(Value *f1, Value *f2, vector<Value*> *inv1, vector<Value*> *inv2,
                   list<FullMap> *result);
 map<Value*, uint32_t> buildinmap(vector<Value*> *vv, vector<uint32_t> *input);
-vector<Value*> getInputVector(Value *f); // get formula f's inputs as a vector
 string getValueName(Value *v);
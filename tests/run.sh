@@ -0,0 +1,134 @@
+#!/bin/sh
+#
+# Regression tests of loopdetect and llse on small synthetic traces
+#
+# round.txt      8 iterations of a TEA-like round loop called once
+# roundsub.txt   the same loop with sub and another delta
+# body.txt       the first iteration of round.txt as a text trace
+# bodyalias.txt  body.txt with both key reads at one address
+# dict.txt       constant dictionary for roundsub.txt
+# nested.txt     a byte copy loop over the rows of two arrays
+# slice.txt      a target with a lea and a shld that symexec does not execute
+# sliceref.txt   the formula slice.txt computes
+#
+# usage: sh tests/run.sh, after make
+#
+
+# the tools write their formula files to the current directory
+DIR=$(cd "$(dirname "$0")" && pwd)
+LLSE=$DIR/../llse
+LOOPDETECT=$DIR/../loopdetect
+TMP=$(mktemp -d)
+trap 'rm -rf $TMP' EXIT
+cd $TMP
+failed=0
+
+pass() { echo "ok   $1"; }
+fail() { echo "FAIL $1"; failed=1; }
+
+# same NAME FILE1 FILE2: the two outputs are equal
+same()
+{
+     if cmp -s "$2" "$3"; then pass "$1"; else fail "$1"; diff "$2" "$3" | head -10; fi
+}
+
+# has NAME FILE PATTERN: the output has a line matching PATTERN
+has()
+{
+     if grep -q "$3" "$2"; then pass "$1"; else fail "$1"; fi
+}
+
+# hasnot NAME FILE PATTERN: no line of the output matches PATTERN
+hasnot()
+{
+     if grep -q "$3" "$2"; then fail "$1"; else pass "$1"; fi
+}
+
+# a loop instance read from the container is compared like its text trace
+$LOOPDETECT -o $TMP/loops.dat $DIR/round.txt > $TMP/detect.out
+$LLSE -l $TMP/loops.dat > $TMP/list.out
+has "loopfile: instance listed" $TMP/list.out "^1	1	401005	1	11	"
+$LLSE $TMP/loops.dat:1 $TMP/loops.dat:1 > $TMP/file.out
+$LLSE $DIR/body.txt $DIR/body.txt > $TMP/text.out
+same "loopfile: container equals text trace" $TMP/file.out $TMP/text.out
+has "loopfile: self mapping" $TMP/text.out "^1: variable mapping result: 1 possible"
+
+# loops are ranked by the crypto constants in their immediates and tables
+has "constscan: builtin constant" $TMP/detect.out "crypto constants: 1 hits tea_delta"
+$LOOPDETECT -o $TMP/sub.dat $DIR/roundsub.txt > $TMP/sub.out
+hasnot "constscan: no constant" $TMP/sub.out "crypto constants"
+$LOOPDETECT -k $DIR/dict.txt -o $TMP/sub.dat $DIR/roundsub.txt > $TMP/subk.out
+has "constscan: dictionary file" $TMP/subk.out "crypto constants: 3 hits test_delta test_key"
+
+# a memory instruction keeps its stride in the innermost loop it runs in
+$LOOPDETECT -n all -o $TMP/nested.dat $DIR/nested.txt > $TMP/nested.out
+has "loopfeature: inner loop strided" $TMP/nested.out "^loop 40100a"
+has "loopfeature: outer loop strided" $TMP/nested.out "mem const 0 strided 2 irregular 0 table 0 score -0.23"
+hasnot "loopfeature: no irregular stream" $TMP/nested.out "irregular [1-9]"
+
+# verdicts are cached per reference, target, alias pattern and options
+mkdir $TMP/cache
+$LLSE -C $TMP/cache $DIR/body.txt $DIR/body.txt > $TMP/c1.out
+$LLSE -C $TMP/cache $DIR/body.txt $DIR/body.txt > $TMP/c2.out
+has "cache: verdict reused" $TMP/c2.out "^cached verdict: 1 of 3 formulas mapped"
+$LLSE -C $TMP/cache -s $DIR/body.txt $DIR/body.txt > $TMP/c3.out
+hasnot "cache: other options" $TMP/c3.out "cached verdict"
+$LLSE -C $TMP/cache $DIR/body.txt $DIR/bodyalias.txt > $TMP/c4.out
+hasnot "cache: other alias pattern" $TMP/c4.out "cached verdict"
+sed -n 3,13p $DIR/roundsub.txt > $TMP/bodysub.txt
+$LLSE -C $TMP/cache $DIR/body.txt $TMP/bodysub.txt > $TMP/c5.out
+hasnot "cache: other target of the same length" $TMP/c5.out "cached verdict"
+
+# loopdetect keeps writing bodies that llse compared
+$LOOPDETECT -C $TMP/cache -o $TMP/loops2.dat $DIR/round.txt > $TMP/d1.out
+$LLSE -C $TMP/cache $TMP/loops2.dat:1 $TMP/loops2.dat:1 > /dev/null
+$LOOPDETECT -C $TMP/cache -o $TMP/loops2.dat $DIR/round.txt > $TMP/d2.out
+has "cache: body seen before" $TMP/d2.out "^1 loop instances already in the cache"
+has "cache: body still written" $TMP/d2.out "^write 1 loop instances"
+
+# a sliced run gives the results of the whole run, the diagnostics only
+# count the executed instructions
+result() { grep -v "^slice:" | sed '/^diagnostics:/,$d'; }
+$LLSE $DIR/sliceref.txt $DIR/slice.txt | result > $TMP/s1.out
+$LLSE -s $DIR/sliceref.txt $DIR/slice.txt | result > $TMP/s2.out
+same "slice: unmodelled instructions" $TMP/s1.out $TMP/s2.out
+has "slice: target mapped" $TMP/s2.out "^1: variable mapping result: 1 possible"
+$LLSE $DIR/body.txt $DIR/body.txt | result > $TMP/s3.out
+$LLSE -s $DIR/body.txt $DIR/body.txt | result > $TMP/s4.out
+same "slice: loop body" $TMP/s3.out $TMP/s4.out
+
+# targets with a common prefix execute it once and each suffix from a
+# snapshot, the results are those of separate runs
+sed -n 3,24p $DIR/round.txt > $TMP/w2.txt
+sed -n 3,35p $DIR/round.txt > $TMP/w3.txt
+for opts in "" "-c 8"; do
+     $LLSE $opts $DIR/body.txt $DIR/body.txt $TMP/w2.txt $TMP/w3.txt > $TMP/p1.out
+     has "snapshot: prefix shared${opts:+ $opts}" $TMP/p1.out "^shared prefix: 11 instructions"
+     grep -v "^shared prefix:" $TMP/p1.out | result > $TMP/p2.out
+     for t in $DIR/body.txt $TMP/w2.txt $TMP/w3.txt; do
+          echo "$t:"
+          $LLSE $opts $DIR/body.txt $t | result
+     done > $TMP/p3.out
+     same "snapshot: suffixes equal separate runs${opts:+ $opts}" $TMP/p2.out $TMP/p3.out
+done
+
+# iterations applied from a loop summary give the results of executing them
+for t in nested round; do
+     $LLSE $DIR/$t.txt $DIR/$t.txt | result > $TMP/l1.out
+     $LLSE -L $DIR/$t.txt $DIR/$t.txt | result > $TMP/l2.out
+     same "summary: $t.txt" $TMP/l1.out $TMP/l2.out
+     $LLSE -L -s $DIR/$t.txt $DIR/$t.txt | result > $TMP/l3.out
+     same "summary: $t.txt sliced" $TMP/l1.out $TMP/l3.out
+done
+
+# an operand which is not parsed is reported, its instruction is not executed
+sed '3s/dword ptr \[esi\]/dword ptr [xmm0]/' $DIR/body.txt > $TMP/bad.txt
+$LLSE $DIR/body.txt $TMP/bad.txt > $TMP/b1.out 2>&1
+has "operand: not parsed" $TMP/b1.out "40100a  operand 2 is not parsed!"
+has "operand: other instructions run" $TMP/b1.out "^3 fomulas found"
+
+if [ $failed -ne 0 ]; then
+     echo "some tests failed"
+     exit 1
+fi
+echo "all tests passed"
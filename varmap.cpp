@@ -2,6 +2,7 @@
 #include <list>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <bitset>
 #include <vector>
 #include <algorithm>
@@ -78,7 +79,7 @@ void BitMatrix::show()
           for (int j = 0, ncol = m[i].size(); j < ncol; ++j) {
                cout << m[i][j] << " ";
           }
-          cout << endl;
+          cout << '\n';
      }
 }
 
@@ -148,6 +149,20 @@ void randomizeMappedVar(BitMatrix *im1, BitMatrix *im2, map<int,int> *mappedvar)
      }
 }
 
+// set mapped variables in every row of im1 and im2 to the same random boolean value
+void randomizeMappedRows(BitMatrix *im1, BitMatrix *im2, map<int,int> *mappedvar)
+{
+     srand(time(NULL));
+
+     for (int i = 0, nrow = im1->m.size(); i < nrow; ++i) {
+          for (map<int,int>::iterator it = mappedvar->begin(); it != mappedvar->end(); ++it) {
+               bool r = rand() % 2;
+               im1->m[i][it->first] = r;
+               im2->m[i][it->second] = r;
+          }
+     }
+}
+
 // set mapped variables in input matrix im1 and im2 as identity matrix
 void setIdentityMatrix(BitMatrix *im1, BitMatrix *im2, map<int,int> *mappedvar)
 {
@@ -190,20 +205,40 @@ void setIdentityMatrix(BitMatrix *im1, BitMatrix *im2, map<int,int> *mappedvar)
 }
 
 // set the output matrix om based on the input matrix im
-// each row in om is the output of f
+// each row in om is the output of f, all rows are evaluated in one batch
 int setOutMatrix(BitMatrix *im, Value *f, vector<Value*> *iv, vector<Value*> *ov,
                     SEEngine *se, BitMatrix *om)
 {
-     for (int i = 0, nrow = im->m.size(); i < nrow; ++i) {
-          map<Value*, uint32_t> input = bv2var(im->m[i], iv);
-          uint32_t output = se->conexec(f, &input);
-          // cout << i << ": ";
-          // cout << hex << output << endl;
-          map<Value*, uint32_t> outmap = {{(*ov)[0], output}};
-          vector<bool> outbv = var2bv(&outmap, ov);
-          om->m[i] = outbv;
+     int nrow = im->m.size();
+     int nin = iv->size();
+     vector<uint32_t> in(nin * nrow), out(nrow);
+
+     // input k of row i goes to in[k*nrow + i]
+     for (int i = 0; i < nrow; ++i) {
+          vector<bool> &row = im->m[i];
+          if ((int)row.size() != 32 * nin) {
+               cout << "setOutMatrix: im and iv are not consistent" << '\n';
+               return 0;
+          }
+          for (int k = 0; k < nin; ++k) {
+               uint32_t v = 0;
+               for (int j = 0; j < 32; ++j) {
+                    if (row[k*32+j]) v |= 1u << j;
+               }
+               in[k*nrow + i] = v;
+          }
+     }
+
+     if (nrow != 0 && se->conexecBatch(f, iv, in.data(), nrow, out.data()) != 0)
+          return 0;
+
+     for (int i = 0; i < nrow; ++i) {
+          vector<bool> &outbv = om->m[i];
+          outbv.resize(32 * ov->size());
+          for (int j = 0; j < 32; ++j) {
+               outbv[j] = (out[i] >> j) & 1;
+          }
      }
-     // cout << dec << endl;
 
      return 1;
 }
@@ -213,7 +248,7 @@ map<Value*, uint32_t> bv2var(vector<bool> bv, vector<Value*> *vv)
 {
      map<Value*, uint32_t> varm;
      if (bv.size() != 32 * vv->size()) {
-          cout << "bv2var: bv and vv are not consistent" << endl;
+          cout << "bv2var: bv and vv are not consistent" << '\n';
           return varm;
      }
 
@@ -234,7 +269,7 @@ vector<bool> var2bv(map<Value*, uint32_t> *varm, vector<Value*> *vv)
      vector<bool> bv;
 
      if (varm->size() != vv->size()) {
-          cout << "var2bv: varm and vv are not consistent!" << endl;
+          cout << "var2bv: varm and vv are not consistent!" << '\n';
           return bv;
      }
 
@@ -405,7 +440,7 @@ void printVar(map<Value*, uint32_t> *varm)
      for (map<Value*, uint32_t>::iterator it = varm->begin(); it != varm->end(); ++it) {
           cout << getValueName(it->first) << ": ";
           cout << hex << it->second;
-          cout << dec << endl;
+          cout << dec << '\n';
      }
 }
 
@@ -415,7 +450,7 @@ void printBV(vector<bool> *bv)
 {
      for (int i = 0, max = bv->size(); i < max; ++i) {
           cout << (*bv)[i] << " ";
-          if (i == 31) cout << endl;
+          if (i == 31) cout << '\n';
      }
 }
 
@@ -426,7 +461,7 @@ void printVecInt(vector<int> *v)
      for (vector<int>::iterator it = v->begin(); it != v->end(); ++it) {
           cout << *it << " ";
      }
-     cout << endl;
+     cout << '\n';
 }
 
 
@@ -440,14 +475,14 @@ void printPartialMapping(vector<PartMap> *unmap)
           cout << "} -> {";
           for (set<int>::iterator it2 = (*unmap)[i].second.begin(); it2 != (*unmap)[i].second.end(); ++it2)
                cout << *it2 << ",";
-          cout << "}" << endl;
+          cout << "}" << '\n';
      }
 }
 
 void printMapInt(map<int,int> *m)
 {
      for (map<int,int>::iterator it = m->begin(); it != m->end(); ++it) {
-          cout << it->first << " -> " << it->second << endl;
+          cout << it->first << " -> " << it->second << '\n';
      }
 }
 
@@ -537,12 +572,22 @@ void varmap(Value *f1, Value *f2, SEEngine *se1, SEEngine *se2,
 
      int ninmap = inmap.size();
 
-     BitMatrix im1(32*ninv1 - ninmap, 32*ninv1), im2(32*ninv2 - ninmap, 32*ninv2);
-     randomizeMappedVar(&im1, &im2, &inmap);
-     setIdentityMatrix(&im1, &im2, &inmap);
+     // When all input bits are mapped, the outputs are told apart by random
+     // inputs instead of an identity matrix of the unmapped inputs
+     int nrow = 32*ninv1 - ninmap;
+     bool allmapped = nrow == 0;
+     if (allmapped) nrow = 32;
 
+     BitMatrix im1(nrow, 32*ninv1), im2(nrow, 32*ninv2);
+     if (allmapped) {
+          randomizeMappedRows(&im1, &im2, &inmap);
+     } else {
+          randomizeMappedVar(&im1, &im2, &inmap);
+          setIdentityMatrix(&im1, &im2, &inmap);
+     }
 
-     BitMatrix om1(32*ninv1 - ninmap,32), om2(32*ninv2 - ninmap,32);
+
+     BitMatrix om1(nrow,32), om2(nrow,32);
      vector<Value*> outv1 = {f1};
      vector<Value*> outv2 = {f2};
 
@@ -623,15 +668,17 @@ void varmap(Value *f1, Value *f2, SEEngine *se1, SEEngine *se2,
      }
 }
 
-void varmapAndoutputCVC(SEEngine *se1, Value *v1, SEEngine *se2, Value *v2)
+// return the number of possible mappings found
+int varmapAndoutputCVC(SEEngine *se1, Value *v1, SEEngine *se2, Value *v2)
 {
-     vector<Value*> inv1 = getInputVector(v1);
-     vector<Value*> inv2 = getInputVector(v2);
+     vector<Value*> inv1 = se1->getInputVector(v1);
+     vector<Value*> inv2 = se2->getInputVector(v2);
 
-     // skip variable mapping when the inputs have different number of bits
-     if (inv1.size() != inv2.size()) {
-          cout << "no mapping found" << endl;
-          return;
+     // skip variable mapping when the inputs have different number of bits,
+     // or when the formulas are constant
+     if (inv1.size() != inv2.size() || inv1.empty()) {
+          cout << "no mapping found" << '\n';
+          return 0;
      }
 
      // initialize the paritial mapping in/out set
@@ -657,10 +704,11 @@ void varmapAndoutputCVC(SEEngine *se1, Value *v1, SEEngine *se2, Value *v2)
 
      varmap(v1, v2, se1, se2, &inv1, &inv2, vpm1, vpm2, inmap, outmap, &result);
      if (result.size() != 0) {
-          cout << "variable mapping result: " << result.size() << " possible mapping found." << endl;
+          cout << "variable mapping result: " << result.size() << " possible mapping found." << '\n';
           outputBitCVC(v1, v2, &inv1, &inv2, &result);
      } else {
-          cout << "no mapping found" << endl;
+          cout << "no mapping found" << '\n';
      }
 
+     return result.size();
 }
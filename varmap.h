@@ -2,7 +2,7 @@ struct BitMatrix;
 
 typedef pair< set<int>,set<int> > PartMap;
 
-void varmapAndoutputCVC(SEEngine *se1, Value *v1, SEEngine *se2, Value *v2);
+int varmapAndoutputCVC(SEEngine *se1, Value *v1, SEEngine *se2, Value *v2);
 
 void printVar(map<Value*, uint32_t> *varm);
 void printBV(vector<bool> *bv);